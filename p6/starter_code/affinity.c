@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+// Topology keys for one CPU, used to order the automatic layout
+struct cpu_topo
+{
+    int cpu;
+    int llc; // First CPU sharing the last-level cache
+    int smt; // Position among the hardware threads of its core
+    int core; // First hardware thread of its core
+};
+
+// Parse a list like "0-3,8,10-11" into cpus, at most max entries
+// Returns the number of CPUs parsed, -1 on a malformed list
+static int parse_cpu_list(const char *list, int *cpus, int max)
+{
+    int n = 0;
+    const char *p = list;
+    while (*p != '\0' && *p != '\n')
+    {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        if (end == p || lo < 0)
+            return -1;
+        long hi = lo;
+        if (*end == '-')
+        {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo)
+                return -1;
+        }
+        for (long c = lo; c <= hi && n < max; c++)
+            cpus[n++] = c;
+        p = end;
+        if (*p == ',')
+            p++;
+        else if (*p != '\0' && *p != '\n')
+            return -1;
+    }
+    return n;
+}
+
+// Read a CPU list from a sysfs file, -1 if it can't be read
+static int read_cpu_list(const char *path, int *cpus, int max)
+{
+    char buf[4096];
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    char *line = fgets(buf, sizeof(buf), f);
+    fclose(f);
+    return line == NULL ? -1 : parse_cpu_list(buf, cpus, max);
+}
+
+// Fill in the LLC and core keys of t->cpu from sysfs
+// Missing files (e.g. in containers) leave the CPU in its own group
+static void read_topology(struct cpu_topo *t)
+{
+    static int shared[MAX_AFFINITY_CPUS];
+    char path[256];
+    t->llc = t->core = t->cpu;
+    t->smt = 0;
+
+    // The highest cache index is the last-level cache
+    for (int idx = 0; idx < 8; idx++)
+    {
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/shared_cpu_list", t->cpu, idx);
+        if (read_cpu_list(path, shared, MAX_AFFINITY_CPUS) > 0)
+            t->llc = shared[0];
+    }
+
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/thread_siblings_list", t->cpu);
+    int n = read_cpu_list(path, shared, MAX_AFFINITY_CPUS);
+    if (n > 0)
+    {
+        t->core = shared[0];
+        for (int i = 0; i < n; i++)
+            if (shared[i] == t->cpu)
+                t->smt = i;
+    }
+}
+
+// LLC first, then one hardware thread per core before any SMT sibling
+static int topo_cmp(const void *x, const void *y)
+{
+    const struct cpu_topo *a = x, *b = y;
+    if (a->llc != b->llc)
+        return a->llc - b->llc;
+    if (a->smt != b->smt)
+        return a->smt - b->smt;
+    return a->core - b->core;
+}
+
+// Build the automatic layout: online CPUs in LLC/core order, with even
+// slots going to server workers and odd slots to client workers so that
+// worker i of each process runs on neighbouring cores of the same LLC
+static int auto_layout(struct affinity *a, enum affinity_role role)
+{
+    static int online[MAX_AFFINITY_CPUS];
+    static struct cpu_topo topo[MAX_AFFINITY_CPUS];
+    int n = read_cpu_list(SYSFS_CPU "/online", online, MAX_AFFINITY_CPUS);
+    if (n <= 0)
+        return -1;
+
+    for (int i = 0; i < n; i++)
+    {
+        topo[i].cpu = online[i];
+        read_topology(&topo[i]);
+    }
+    qsort(topo, n, sizeof(struct cpu_topo), topo_cmp);
+
+    a->ncpus = 0;
+    for (int i = role; i < n; i += 2)
+        a->cpus[a->ncpus++] = topo[i].cpu;
+    // A single CPU is shared by both processes
+    if (a->ncpus == 0)
+        a->cpus[a->ncpus++] = topo[0].cpu;
+    return 0;
+}
+
+int affinity_init(struct affinity *a, const char *cpu_list, const char *mode, enum affinity_role role)
+{
+    a->ncpus = 0;
+    if (cpu_list != NULL)
+    {
+        a->ncpus = parse_cpu_list(cpu_list, a->cpus, MAX_AFFINITY_CPUS);
+        if (a->ncpus <= 0)
+        {
+            fprintf(stderr, "Invalid CPU list %s\n", cpu_list);
+            a->ncpus = 0;
+            return -1;
+        }
+        return 0;
+    }
+    if (mode == NULL || !strcmp(mode, "none"))
+        return 0;
+    if (!strcmp(mode, "auto"))
+    {
+        if (auto_layout(a, role) < 0)
+        {
+            fprintf(stderr, "Could not read the CPU topology, threads will not be pinned\n");
+            a->ncpus = 0;
+        }
+        return 0;
+    }
+    fprintf(stderr, "Unknown affinity mode %s\n", mode);
+    return -1;
+}
+
+int affinity_pin(struct affinity *a, int worker)
+{
+    if (a->ncpus == 0)
+        return -1;
+    int cpu = a->cpus[worker % a->ncpus];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0)
+    {
+        fprintf(stderr, "pthread_setaffinity_np(%d): %s\n", cpu, strerror(rc));
+        return -1;
+    }
+    return cpu;
+}
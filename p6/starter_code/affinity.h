@@ -0,0 +1,38 @@
+#pragma once
+
+#define MAX_AFFINITY_CPUS 1024
+
+/* Which binary is placing its workers - the automatic layout interleaves
+ * the two so that server worker i and client worker i share an LLC */
+enum affinity_role
+{
+	AFFINITY_SERVER = 0,
+	AFFINITY_CLIENT = 1
+};
+
+/* Where each worker thread runs: worker i is pinned to cpus[i % ncpus] */
+struct affinity
+{
+	int ncpus; /* 0 means workers are not pinned */
+	int cpus[MAX_AFFINITY_CPUS];
+};
+
+/*
+ * Build the placement for this process
+ * @param a The placement to fill in
+ * @param cpu_list Explicit list such as "0-3,8,10-11", or NULL
+ * @param mode "none" or "auto" (LLC-aware layout from sysfs), or NULL -
+ * ignored if cpu_list is given
+ * @param role Which half of the automatic layout this process takes
+ * @return 0 on success, -1 if the list or mode is invalid
+ */
+int affinity_init(struct affinity *a, const char *cpu_list, const char *mode, enum affinity_role role);
+
+/*
+ * Pin the calling thread according to a
+ * Call at the start of the worker, before it allocates or first touches
+ * its hot state, so first-touch places that memory on the worker's node
+ * @param worker Index of the worker thread
+ * @return The CPU the thread was pinned to, -1 if it was left unpinned
+ */
+int affinity_pin(struct affinity *a, int worker);
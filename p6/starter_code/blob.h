@@ -0,0 +1,62 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Variable-length keys and values (VPUT/VGET requests)
+ *
+ * The client writes a request's key, and a VPUT's value, into its window's
+ * blob_payload. The server copies a VPUT into an entry of its arena, a
+ * size-classed heap in the shared region (ring->arena_off, arena_size), and
+ * answers a VGET with the entry's offset. The client reads the value in
+ * place. An entry never changes while it is live: a VPUT to the same key
+ * writes a new entry and frees the old one, bumping its version, so the
+ * client checks that the version still matches the reply after reading.
+ */
+
+/* Limits of one request - an entry of the largest size still fits the
+ * arena's largest block */
+#define BLOB_MAX_KEY 250
+#define BLOB_MAX_VALUE (512 * 1024)
+
+/* One per window of the Request-status Board, like multi_payload */
+struct blob_payload {
+	uint32_t key_len;
+	uint32_t val_len;	   /* VPUT only */
+	uint32_t reply_off;	   /* VGET result: offset of the entry, 0 if the key is absent */
+	uint32_t reply_version; /* VGET result: the entry's version when it was found */
+	char data[];		   /* key, then a VPUT's value */
+};
+
+/* An entry of the server's arena. All entries whose keys hash alike are
+ * chained through next, starting from the table slot of the hash */
+struct blob_entry {
+	uint32_t version; /* Even while the entry is live, odd while it is free or being written */
+	uint32_t next;	  /* Offset of the next entry of the chain, 0 at the end */
+	uint32_t key_len;
+	uint32_t val_len;
+	char data[]; /* key, then value */
+};
+
+/* FNV-1a, for key hashes (the descriptor's k) and value checksums */
+static inline uint32_t blob_hash(const void *p, size_t len)
+{
+	const unsigned char *s = p;
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ s[i]) * 16777619u;
+	return h;
+}
+
+/* The value of the VPUT at index req of a workload - generated, so neither
+ * the workload file nor the solution file has to hold the bytes */
+static inline void blob_fill(char *dst, uint32_t len, uint64_t req)
+{
+	uint32_t x = (uint32_t)req * 2654435761u + 1;
+	for (uint32_t i = 0; i < len; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		dst[i] = (char)x;
+	}
+}
@@ -6,44 +6,74 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <signal.h>
 #include <string.h>
 
 #include "common.h"
 #include "ring_buffer.h"
-#include <wasm32-wasi/getopt.h>
+#include "affinity.h"
+#include "shm.h"
+#include "registry.h"
+#include "workload.h"
+#include "latency.h"
+#include "kv_stats.h"
+#include "blob.h"
+#include <getopt.h>
 
 #define MAX_THREADS 128
-#define LINE_LEN 256
-
-#define PUT_STR "put"
-#define GET_STR "get"
-#define DEL_STR "del"
+#define LINE_LEN 2048
+#define MAX_BURST 64
+#define MAX_EXTRA_ARGS 16
 
 #define READY 1
 #define NOT_READY 0
 
-struct request
-{
-	key_type k;
-	value_type v;
-	enum REQUEST_TYPE t;
-};
-
 struct thread_context
 {
 	int tid;						 /* thread ID */
 	int num_reqs;					 /* # of requests that this thread is responsible for */
 	struct request *reqs;			 /* requests assigned to this thread */
-	struct buffer_descriptor *res;	 /* Corresponding result for each request in reqs */
+	struct buffer_descriptor *res;	 /* Corresponding result for each request in reqs (NULL unless -c is set) */
 	struct buffer_descriptor *comps; /* Pointer to the start of the status board for this thread */
 	int win_size;
 	int nxt_comp; /* next completion that we're expecting */
 	int comp_off; /* byte offset of the status board for this thread, w.r.t the start of the shared memory area */
+	struct ring *sq; /* this thread's own submission ring (sharded mode only) */
+	struct completion_bell *bell; /* where this thread sleeps for completions (event mode only) */
+	int bell_off; /* byte offset of bell, sent to the server with each request */
+	struct multi_payload *payloads; /* one per window, for MGET/MPUT (NULL if the workload has none) */
+	int payload_off; /* byte offset of payloads */
+	char *blobs; /* one blob_slot per window, for VPUT/VGET (NULL if the workload has none) */
+	int blob_off; /* byte offset of blobs */
+	uint64_t stale_reads; /* VGET replies whose entry was replaced before we read it */
+	struct ring *cq; /* where the server posts this thread's completions (out-of-order mode only) */
+	int *free_slots; /* windows with no request in flight (out-of-order mode only) */
+	int nfree;
+	int *slot_req; /* request index in flight in each window (out-of-order mode only) */
+	struct latency_stats *lat; /* latency of this thread's requests (-L only) */
 };
 
 struct ring *ring = NULL;
+struct ring *shards = NULL; /* one submission ring per thread if sharded is set */
+struct ring *partitions = NULL; /* one submission ring per server thread if partitioned is set */
+int num_partitions = 0;
+int board_off = sizeof(struct ring); /* byte offset of the Request-status Board */
+int bells_off = 0; /* byte offset of the completion bells, if event_driven is set */
+int payloads_off = 0; /* byte offset of the MGET/MPUT payloads, if has_multi is set */
+int has_multi = 0; /* the workload has MGET/MPUT requests */
+int blobs_off = 0; /* byte offset of the VPUT/VGET payloads, if has_blobs is set */
+int blob_slot = 0; /* bytes per window of those payloads */
+int has_blobs = 0; /* the workload has VPUT/VGET requests */
+int arena_mb = 64; /* size of the server's arena for VPUT values, if has_blobs is set */
+uint32_t ttl_ms = 0; /* lifetime of every PUT's key if the server runs as a cache, 0 for its default */
+int cqs_off = 0; /* byte offset of the completion rings, if out_of_order is set */
+int stats_off = 0; /* byte offset of the server's statistics */
+int out_of_order = 0;
+char *attach_path = NULL; /* region of a server started with --listen, instead of our own */
+struct attach_registry *registry = NULL;
+int attach_slot = -1;
 char *shmem_area = NULL;
 char shm_file[] = "shmem_file";
 char workload_file[256];
@@ -51,19 +81,32 @@ char expected_file[256];
 char server_exec[256];
 pthread_t threads[MAX_THREADS];
 struct thread_context contexts[MAX_THREADS];
+struct workload workload; /* requests, mapped in place if the workload file is binary */
 struct request *requests;
-struct buffer_descriptor *results;
+struct buffer_descriptor *results = NULL; /* only kept if validate is set */
+value_type *mget_results = NULL; /* values returned for each workload.keys entry of an MGET, same condition */
 int num_threads = 4;
 int win_size = 1;
-int num_requests = 4;
+uint64_t num_requests = 4;
 int verbose = 0;
 int child_pid = -1;
 int do_fork = 0;
 int validate = 0;
+int sharded = 0;
+int partitioned = 0;
+int event_driven = 0;
+int trace_latency = 0;
+struct affinity affinity; /* where each client thread runs */
+char *affinity_mode = NULL; /* --affinity, also forwarded to the kv_store program */
+int shm_flags = 0; /* SHM_MEMFD and SHM_HUGE, see shm.h */
+struct shm_region shm;
 
 /* Server arguments */
 int s_num_threads = 1;
 int s_init_table_size = 1000;
+int s_burst_size = 32;
+char s_backend[32] = "chain";
+char s_extra_args[256] = ""; /* passed to the kv_store program as-is, split on spaces */
 
 /* prints "Client" before each line of output because the child will also be printing
  * to the same terminal */
@@ -83,7 +126,7 @@ void fork_server()
 	if (pid == 0)
 	{ /* The child process */
 		/* number of arguments including the NULL pointer at the end */
-		const int NUM_ARGS = 7;
+		const int NUM_ARGS = 16 + MAX_EXTRA_ARGS;
 		const int MAX_ARG_LEN = 256;
 		char **argv = malloc(NUM_ARGS * sizeof(char *));
 		if (argv == NULL)
@@ -102,8 +145,27 @@ void fork_server()
 		sprintf(argv[idx++], "%d", s_init_table_size);
 		sprintf(argv[idx++], "-n");
 		sprintf(argv[idx++], "%d", s_num_threads);
+		sprintf(argv[idx++], "-b");
+		sprintf(argv[idx++], "%d", s_burst_size);
+		sprintf(argv[idx++], "-k");
+		sprintf(argv[idx++], "%s", s_backend);
 		if (verbose)
 			sprintf(argv[idx++], "-v");
+		if (affinity_mode != NULL)
+		{
+			sprintf(argv[idx++], "--affinity");
+			strncpy(argv[idx++], affinity_mode, MAX_ARG_LEN - 1);
+		}
+		/* The memfd is not close-on-exec, so the server maps the same object */
+		if (shm.fd >= 0)
+		{
+			sprintf(argv[idx++], "--shm-fd");
+			sprintf(argv[idx++], "%d", shm.fd);
+		}
+		if (shm_flags & SHM_HUGE)
+			sprintf(argv[idx++], "--huge");
+		for (char *tok = strtok(s_extra_args, " "); tok != NULL && idx < NUM_ARGS - 1; tok = strtok(NULL, " "))
+			strncpy(argv[idx++], tok, MAX_ARG_LEN - 1);
 		argv[idx++] = NULL;
 		execvp(server_exec, argv);
 
@@ -120,34 +182,162 @@ void fork_server()
 	}
 }
 
+/* With -O, set up the completion ring of every thread */
+void init_completion_rings()
+{
+	if (out_of_order)
+		for (int i = 0; i < num_threads; i++)
+			if (init_ring((struct ring *)(shmem_area + cqs_off) + i) < 0)
+				exit(EXIT_FAILURE);
+}
+
+/*
+ * Attach to a server started with --listen instead of creating the region
+ * Threads submit through the rings of the client slot we claim, and the
+ * board (with everything that follows it) goes in the slot's segment
+ */
+void attach_server()
+{
+	if (shm_attach(&shm, attach_path, -1, shm_flags) < 0)
+		exit(EXIT_FAILURE);
+	registry = registry_find(shm.mem);
+	if (registry == NULL)
+	{
+		fprintf(stderr, "%s was not created by server --listen\n", attach_path);
+		exit(EXIT_FAILURE);
+	}
+	attach_slot = registry_attach(registry, num_threads);
+	if (attach_slot < 0)
+	{
+		fprintf(stderr, "No free client slot for %d threads (the server allows %u threads per client)\n",
+				num_threads, registry->client_rings);
+		exit(EXIT_FAILURE);
+	}
+	PRINTV("Attached to %s as client %d\n", attach_path, attach_slot);
+
+	shmem_area = shm.mem;
+	ring = (struct ring *)shm.mem;
+	shards = registry_rings(registry, attach_slot);
+	sharded = 1;
+	board_off = registry_segment_off(registry, attach_slot);
+}
+
 /*
  * Initialize the shared memory ring buffer
  * Sets the shmem_area global variable to the beginning of the shared region
  * Sets the ring global variable the beginning of the shared region
  * Shared memory area is organized as follows:
  * | RING | TID_0_COMPLETIONS | TID_1_COMPLETIONS | ... | TID_N_COMPLETIONS |
+ * With -r, every thread also gets its own submission ring and the first ring
+ * only serves as the header and the server's doorbell:
+ * | RING | TID_0_RING | ... | TID_N_RING | TID_0_COMPLETIONS | ... |
+ * With -P, the rings after the first one belong to the server threads instead,
+ * one per key partition:
+ * | RING | PARTITION_0_RING | ... | PARTITION_M_RING | TID_0_COMPLETIONS | ... |
+ * With -E, one completion bell per thread follows the board, cache-line aligned:
+ * | ... | TID_N_COMPLETIONS | TID_0_BELL | ... | TID_N_BELL |
+ * If the workload has MGET/MPUT requests, one multi_payload per window
+ * follows, cache-line aligned and in the same order as the board:
+ * | ... | TID_0_PAYLOADS | ... | TID_N_PAYLOADS |
+ * Likewise for VPUT/VGET requests, with one blob_payload of blob_slot bytes
+ * per window:
+ * | ... | TID_0_BLOBS | ... | TID_N_BLOBS |
+ * With -O, every thread gets a completion ring at the end, and the board is
+ * left unused:
+ * | ... | TID_0_CQ | ... | TID_N_CQ |
+ * The server's statistics come last, for kvstat to read (see kv_stats.h),
+ * followed by the server's arena for VPUT values if there are any (blob.h):
+ * | ... | STATS | ARENA |
+ * With --attach, the server owns the region (see registry.h) and everything
+ * from the board on lives in this client's segment
  */
 int init_client()
 {
-	int shm_size = sizeof(struct ring) +
-				   num_threads * win_size * sizeof(struct buffer_descriptor);
-
-	int fd = open(shm_file, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-	if (fd < 0)
-		perror("open");
-
-	/* Make the file length exactly shm_size bytes */
-	if (ftruncate(fd, shm_size) == -1)
-		perror("ftruncate");
+	if (attach_path != NULL)
+		attach_server();
+	else if (sharded)
+		board_off = (1 + num_threads) * sizeof(struct ring);
+	else if (partitioned)
+	{
+		num_partitions = s_num_threads;
+		board_off = (1 + num_partitions) * sizeof(struct ring);
+	}
+	/* Sized in 64 bits: the offsets handed to the server are ints, so the
+	 * whole region must stay under 2 GiB, whatever -n, -w and --arena-mb say */
+	uint64_t windows = (uint64_t)num_threads * win_size;
+	uint64_t size = board_off + windows * sizeof(struct buffer_descriptor);
+	uint64_t bells = 0, payloads = 0, blobs = 0, cqs = 0, stats_at = 0, arena_off = 0;
+	if (event_driven)
+	{
+		bells = (size + 63) & ~63ull;
+		size = bells + (uint64_t)num_threads * sizeof(struct completion_bell);
+	}
+	if (has_multi)
+	{
+		payloads = (size + 63) & ~63ull;
+		size = payloads + windows * sizeof(struct multi_payload);
+	}
+	if (has_blobs)
+	{
+		blobs = (size + 63) & ~63ull;
+		size = blobs + windows * blob_slot;
+	}
+	if (out_of_order)
+	{
+		cqs = (size + 63) & ~63ull;
+		size = cqs + (uint64_t)num_threads * sizeof(struct ring);
+	}
 
-	char *mem = mmap(NULL, shm_size, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
-	if (mem == (void *)-1)
-		perror("mmap");
+	if (attach_path == NULL)
+	{
+		stats_at = (size + 63) & ~63ull;
+		size = stats_at + sizeof(struct kv_stats);
+	}
+	if (attach_path == NULL && has_blobs)
+	{
+		arena_off = (size + 63) & ~63ull;
+		size = arena_off + ((uint64_t)arena_mb << 20);
+	}
+	if (size > INT32_MAX)
+	{
+		fprintf(stderr, "The shared region would be %lu bytes, over 2 GiB - lower -n, -w or --arena-mb\n",
+				(unsigned long)size);
+		if (attach_path != NULL)
+			registry_detach(registry, attach_slot);
+		exit(EXIT_FAILURE);
+	}
+	int shm_size = size;
+	bells_off = bells;
+	payloads_off = payloads;
+	blobs_off = blobs;
+	cqs_off = cqs;
+	stats_off = stats_at;
+
+	if (attach_path != NULL)
+	{
+		if ((uint64_t)(shm_size - board_off) > registry->segment_size)
+		{
+			fprintf(stderr, "Needs %d bytes of board space, the server gives each client %lu (--segment-mb)\n",
+					shm_size - board_off, (unsigned long)registry->segment_size);
+			registry_detach(registry, attach_slot);
+			exit(EXIT_FAILURE);
+		}
+		if (has_blobs && ring->arena_size == 0)
+		{
+			fprintf(stderr, "The workload has vput/vget requests, but the server was started without --arena-mb\n");
+			registry_detach(registry, attach_slot);
+			exit(EXIT_FAILURE);
+		}
+		init_completion_rings();
+		return 0;
+	}
 
-	/* mmap dups the fd, no longer needed */
-	close(fd);
+	/* Zeroed and pre-faulted, rounded up to a huge page with --huge */
+	if (shm_create(&shm, shm_file, shm_size, shm_flags) < 0)
+		exit(EXIT_FAILURE);
+	PRINTV("Mapped %zu bytes of shared memory\n", shm.size);
 
-	memset(mem, 0, shm_size);
+	char *mem = shm.mem;
 	ring = (struct ring *)mem;
 	shmem_area = mem;
 	int ring_rc = -1;
@@ -156,63 +346,32 @@ int init_client()
 		printf("Ring initialization failed with %d as return code\n", ring_rc);
 		exit(EXIT_FAILURE);
 	}
+	if (sharded)
+	{
+		shards = ring + 1;
+		for (int i = 0; i < num_threads; i++)
+			if (init_ring(&shards[i]) < 0)
+				exit(EXIT_FAILURE);
+		ring->num_shards = num_threads;
+	}
+	if (partitioned)
+	{
+		partitions = ring + 1;
+		for (int i = 0; i < num_partitions; i++)
+			if (init_ring(&partitions[i]) < 0)
+				exit(EXIT_FAILURE);
+		ring->num_partitions = num_partitions;
+	}
+	ring->stats_off = stats_off;
+	if (has_blobs)
+	{
+		ring->arena_off = arena_off;
+		ring->arena_size = arena_mb << 20;
+	}
+	init_completion_rings();
 
 	if (do_fork)
 		fork_server();
-}
-
-/*
- * Get request type from req_str and set type
- * @return 0 on success, -1 on failure
- * On failure, contents of type are undefined
- */
-int get_req_type(char *req_str, enum REQUEST_TYPE *type)
-{
-	int rc = 0;
-	if (!strcmp(req_str, PUT_STR))
-		*type = PUT;
-	else if (!strcmp(req_str, GET_STR))
-		*type = GET;
-	else
-		rc = -1;
-
-	return rc;
-}
-
-/*
- * Parses an input line and stores the result into requests at index
- * @return 0 on success, -1 on failure
- */
-int add_line_to_req(char *line, int index)
-{
-	char *copy_line = strdup(line);
-	char *tok = strtok(copy_line, " ");
-	if (tok == NULL)
-		return -1;
-
-	enum REQUEST_TYPE type;
-	if (get_req_type(tok, &type) < 0)
-		return -1;
-
-	requests[index].t = type;
-
-	tok = strtok(NULL, " ");
-	if (tok == NULL)
-		return -1;
-
-	int key = atoi(tok);
-	requests[index].k = key;
-
-	int value;
-	if (type == PUT)
-	{
-		tok = strtok(NULL, " ");
-		if (tok == NULL)
-			return -1;
-
-		value = atoi(tok);
-		requests[index].v = value;
-	}
 	return 0;
 }
 
@@ -233,40 +392,59 @@ int count_lines(FILE *f)
 }
 
 /*
- * Reads the workload_file and stores in the requests array (global var)
- * Allocates both requests/results array enough space for all requests
+ * Loads the workload_file into workload: a binary workload (see wl_convert)
+ * is mapped and used in place, a text one is parsed
+ * Allocates the results arrays if the results are going to be checked
  */
 void read_input_files()
 {
-	FILE *f = fopen(workload_file, "r");
-	if (f == NULL)
-		perror("fopen");
-
-	/* Count the number of lines */
-	int nl = count_lines(f);
-	PRINTV("Num lines is %d\n", nl);
-	num_requests = nl;
-
-	/* Allocate request/result arrays */
-	requests = malloc(num_requests * sizeof(struct request));
-	if (requests == NULL)
-		perror("malloc");
+	if (workload_open(workload_file, &workload) < 0)
+		exit(EXIT_FAILURE);
+	num_requests = workload.num_requests;
+	requests = workload.reqs;
+	has_multi = workload.num_keys > 0;
+	has_blobs = workload.num_bytes > 0;
+	blob_slot = (sizeof(struct blob_payload) + workload.max_blob + 63) & ~63;
+	PRINTV("Num requests is %lu\n", num_requests);
+
+	if (!validate)
+		return;
 	results = malloc(num_requests * sizeof(struct buffer_descriptor));
-	if (results == NULL)
+	mget_results = calloc(workload.num_keys, sizeof(value_type));
+	if (results == NULL || (mget_results == NULL && workload.num_keys > 0))
+	{
 		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+}
 
-	/* Read line by line and fill up the requests array
-	 * Ignores invalid lines */
-	char line[LINE_LEN];
-	int index = 0;
-	while (!feof(f))
-	{
-		fgets(line, LINE_LEN, f);
-		if (add_line_to_req(line, index) < 0)
-			continue;
+/*
+ * Partitioned mode: hand each request to the ring of the server thread that
+ * owns its key. The batch is counting-sorted by partition so each ring still
+ * gets its requests as one burst, in submission order
+ * @param bds n requests
+ */
+void submit_partitioned(struct buffer_descriptor *bds, int n)
+{
+	struct buffer_descriptor sorted[MAX_BURST];
+	index_t part[MAX_BURST];
+	int start[MAX_THREADS + 1] = {0};
 
-		index++;
+	for (int i = 0; i < n; i++)
+	{
+		part[i] = partition_of(bds[i].k, num_partitions);
+		start[part[i] + 1]++;
 	}
+	for (int p = 0; p < num_partitions; p++)
+		start[p + 1] += start[p];
+	int fill[MAX_THREADS];
+	memcpy(fill, start, num_partitions * sizeof(int));
+	for (int i = 0; i < n; i++)
+		sorted[fill[part[i]]++] = bds[i];
+
+	for (int p = 0; p < num_partitions; p++)
+		for (int done = start[p]; done < start[p + 1];)
+			done += ring_submit_burst(&partitions[p], sorted + done, start[p + 1] - done);
 }
 
 /*
@@ -278,25 +456,153 @@ void read_input_files()
  */
 void submit_reqs(struct thread_context *ctx, int *last_completed, int *last_submitted)
 {
-	struct buffer_descriptor bd;
+	struct buffer_descriptor bds[MAX_BURST];
 	struct request *reqs = ctx->reqs;
-	/* Keep win_size number of in-flight requests */
-	for (int i = *last_submitted; *last_submitted - *last_completed < win_size; i++)
+	/* Keep win_size number of in-flight requests - everything the window
+	 * allows right now is handed to the ring as bursts */
+	while (*last_submitted - *last_completed < win_size && *last_submitted < ctx->num_reqs)
 	{
-		/* Have we submitted all of the requests? */
-		if (*last_submitted >= ctx->num_reqs)
-			break;
+		int n = 0;
+		for (int i = *last_submitted; i - *last_completed < win_size && i < ctx->num_reqs && n < MAX_BURST; i++, n++)
+		{
+			/* In order, request i always uses window i % win_size. Out of order,
+			 * any window whose request completed is free - the tag maps the
+			 * completion back to it */
+			int slot = i % win_size;
+			if (ctx->cq != NULL)
+			{
+				slot = ctx->free_slots[--ctx->nfree];
+				ctx->slot_req[slot] = i;
+			}
+
+			memset(&bds[n], 0, sizeof(struct buffer_descriptor));
+			bds[n].k = reqs[i].k;
+			bds[n].v = reqs[i].v;
+			bds[n].req_type = reqs[i].t;
+			bds[n].res_off = ctx->comp_off + slot * sizeof(struct buffer_descriptor);
+			bds[n].notify_off = ctx->bell_off;
+			bds[n].cq_off = ctx->cq != NULL ? (char *)ctx->cq - shmem_area : 0;
+			bds[n].tag = slot;
+			if (reqs[i].t == PUT)
+				bds[n].ttl_ms = ttl_ms;
+			if (reqs[i].t == MGET || reqs[i].t == MPUT)
+			{
+				/* The window's previous request has completed, so its payload is free */
+				struct multi_payload *p = &ctx->payloads[slot];
+				p->n = reqs[i].k;
+				memcpy(p->keys, workload.keys + reqs[i].v, p->n * sizeof(key_type));
+				if (reqs[i].t == MPUT)
+					memcpy(p->values, workload.values + reqs[i].v, p->n * sizeof(value_type));
+				bds[n].payload_off = ctx->payload_off + slot * sizeof(struct multi_payload);
+			}
+			if (reqs[i].t == VPUT || reqs[i].t == VGET)
+			{
+				/* Likewise for the window's blob_payload. A VPUT's value is
+				 * generated straight into it */
+				struct blob_payload *p = (struct blob_payload *)(ctx->blobs + slot * blob_slot);
+				const char *key = workload.bytes + reqs[i].k;
+				p->key_len = strlen(key);
+				p->val_len = reqs[i].t == VPUT ? reqs[i].v : 0;
+				memcpy(p->data, key, p->key_len);
+				if (reqs[i].t == VPUT)
+					blob_fill(p->data + p->key_len, p->val_len, reqs + i - requests);
+				bds[n].k = blob_hash(key, p->key_len);
+				bds[n].payload_off = ctx->blob_off + slot * blob_slot;
+			}
+		}
+
+		if (ctx->lat != NULL)
+		{
+			uint64_t now = now_ns();
+			for (int i = 0; i < n; i++)
+				bds[i].t_submit = now;
+		}
+
+		/* The ring may take only part of the batch if it is nearly full */
+		if (partitioned)
+			submit_partitioned(bds, n);
+		for (int done = partitioned ? n : 0; done < n;)
+		{
+			if (ctx->sq != NULL)
+				done += ring_submit_burst_sp(ctx->sq, bds + done, n - done, ring);
+			else
+				done += ring_submit_burst(ring, bds + done, n - done);
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			PRINTV("New submission %u %u\n", bds[i].k, bds[i].v);
+		}
+		*last_submitted += n;
+	}
+}
+
+/*
+ * Read the value a VGET found, in place in the server's arena
+ * The entry may have been replaced and its memory reused since the server
+ * answered, so the read only counts if the entry's version is unchanged
+ * @param p the VGET's payload, holding the server's reply
+ * @return blob_hash of the value, 0 if the key was absent or the entry changed
+ */
+value_type read_blob(struct thread_context *ctx, struct blob_payload *p)
+{
+	if (p->reply_off == 0)
+		return 0;
+	struct blob_entry *e = (struct blob_entry *)(shmem_area + p->reply_off);
+	value_type sum = blob_hash(e->data + p->key_len, p->val_len);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&e->version, __ATOMIC_RELAXED) != p->reply_version)
+	{
+		ctx->stale_reads++;
+		return 0;
+	}
+	return sum;
+}
 
-		memset(&bd, 0, sizeof(struct buffer_descriptor));
-		bd.k = reqs[i].k;
-		bd.v = reqs[i].v;
-		bd.req_type = reqs[i].t;
-		bd.res_off = ctx->comp_off + (*last_submitted % win_size) * sizeof(struct buffer_descriptor);
-		ring_submit(ring, &bd);
-		(*last_submitted)++;
+/*
+ * Keep the result of request r for check_results
+ * @param bd its completion
+ * @param slot the window it used, whose payload holds an MGET's values or a
+ * VGET's reply
+ */
+void save_result(struct thread_context *ctx, int r, struct buffer_descriptor *bd, int slot)
+{
+	memcpy(&ctx->res[r], bd, sizeof(struct buffer_descriptor));
+	struct request *req = &ctx->reqs[r];
+	if (req->t == MGET)
+		memcpy(mget_results + req->v, ctx->payloads[slot].values, req->k * sizeof(value_type));
+	else if (req->t == VGET)
+		ctx->res[r].v = read_blob(ctx, (struct blob_payload *)(ctx->blobs + slot * blob_slot));
+}
 
-		PRINTV("New submission %u %u\n", bd.k, bd.v);
+/*
+ * Out-of-order mode: take whatever completions the server has posted to this
+ * thread's completion ring, in any order
+ * Blocks for at least one if the thread can't submit anything until then
+ * @param ctx context for this thread
+ * @param completed number of requests completed so far, updated
+ * @param last_submitted last request that was submitted
+ */
+void reap_completions(struct thread_context *ctx, int *completed, int *last_submitted)
+{
+	struct buffer_descriptor cbs[MAX_BURST];
+	bool blocked = *last_submitted - *completed == ctx->win_size ||
+				   (*last_submitted == ctx->num_reqs && *completed < ctx->num_reqs);
+	unsigned n = blocked ? ring_get_burst(ctx->cq, cbs, MAX_BURST) : ring_try_get_burst(ctx->cq, cbs, MAX_BURST);
+	uint64_t seen = ctx->lat != NULL && n > 0 ? now_ns() : 0;
+
+	for (unsigned j = 0; j < n; j++)
+	{
+		int slot = cbs[j].tag;
+		int r = ctx->slot_req[slot];
+		PRINTV("New completion: %u %u (request %d)\n", cbs[j].k, cbs[j].v, r);
+		if (ctx->res != NULL)
+			save_result(ctx, r, &cbs[j], slot);
+		if (ctx->lat != NULL)
+			latency_record(ctx->lat, cbs[j].t_submit, cbs[j].t_dequeue, cbs[j].t_complete, seen);
+		ctx->free_slots[ctx->nfree++] = slot;
 	}
+	*completed += n;
 }
 
 /*
@@ -308,6 +614,21 @@ void submit_reqs(struct thread_context *ctx, int *last_completed, int *last_subm
  */
 void process_completions(struct thread_context *ctx, int *last_completed, int *last_submitted)
 {
+	/* Out of order, last_completed is only a count */
+	if (ctx->cq != NULL)
+	{
+		reap_completions(ctx, last_completed, last_submitted);
+		return;
+	}
+
+	/* Event mode: if we can't make progress until the next window completes
+	 * (the window is full, or everything has been submitted), sleep on the
+	 * bell instead of returning to spin in the caller */
+	bool blocked = *last_submitted - *last_completed == ctx->win_size ||
+				   (*last_submitted == ctx->num_reqs && *last_completed < ctx->num_reqs);
+	if (ctx->bell != NULL && blocked)
+		completion_wait(ctx->bell, &ctx->comps[ctx->nxt_comp].ready);
+
 	/* Check completions until we break */
 	while (true)
 	{
@@ -320,8 +641,10 @@ void process_completions(struct thread_context *ctx, int *last_completed, int *l
 			struct buffer_descriptor tmp = ctx->comps[ctx->nxt_comp];
 			PRINTV("New completion: %u %u\n", tmp.k, tmp.v);
 			ctx->comps[ctx->nxt_comp].ready = NOT_READY;
-			memcpy(&ctx->res[*last_completed], &ctx->comps[ctx->nxt_comp],
-				   sizeof(struct buffer_descriptor));
+			if (ctx->res != NULL)
+				save_result(ctx, *last_completed, &tmp, ctx->nxt_comp);
+			if (ctx->lat != NULL)
+				latency_record(ctx->lat, tmp.t_submit, tmp.t_dequeue, tmp.t_complete, now_ns());
 
 			/* Update for the next iteration */
 			(*last_completed)++;
@@ -339,7 +662,58 @@ void process_completions(struct thread_context *ctx, int *last_completed, int *l
  */
 void *thread_function(void *arg)
 {
-	struct thread_context *ctx = arg;
+	struct thread_context *shared_ctx = arg;
+	affinity_pin(&affinity, shared_ctx->tid);
+
+	/* Work on a private copy, first touched after pinning so it lands on this
+	 * thread's node, instead of the contexts[] entry that shares a cache line
+	 * with its neighbours' (nxt_comp is written on every completion) */
+	struct thread_context *ctx = malloc(sizeof(struct thread_context));
+	if (ctx == NULL)
+	{
+		perror("malloc");
+		ctx = shared_ctx;
+	}
+	else
+		memcpy(ctx, shared_ctx, sizeof(struct thread_context));
+
+	/* Start paging in this thread's slice of a mapped workload while the
+	 * other threads do the same for theirs */
+	if (workload.map != NULL)
+	{
+		/* Checked here rather than at open, so the threads check their
+		 * slices in parallel while the kernel pages them in */
+		workload_willneed(ctx->reqs, ctx->num_reqs);
+		uint64_t bad = workload_check(&workload, ctx->reqs, ctx->num_reqs);
+		if (bad < (uint64_t)ctx->num_reqs)
+		{
+			fprintf(stderr, "Invalid request %lu in binary workload\n",
+					(unsigned long)(ctx->reqs - workload.reqs + bad));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (trace_latency)
+	{
+		ctx->lat = calloc(1, sizeof(struct latency_stats));
+		if (ctx->lat == NULL)
+			perror("calloc");
+	}
+
+	if (ctx->cq != NULL)
+	{
+		ctx->free_slots = malloc(ctx->win_size * sizeof(int));
+		ctx->slot_req = malloc(ctx->win_size * sizeof(int));
+		if (ctx->free_slots == NULL || ctx->slot_req == NULL)
+		{
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		for (int i = 0; i < ctx->win_size; i++)
+			ctx->free_slots[i] = ctx->win_size - 1 - i;
+		ctx->nfree = ctx->win_size;
+	}
+
 	int last_completed = 0;
 	int last_submitted = 0;
 	PRINTV("Num reqs is %d\n", ctx->num_reqs);
@@ -354,6 +728,15 @@ void *thread_function(void *arg)
 	/* There might be some completions still in flight */
 	while (last_completed < ctx->num_reqs)
 		process_completions(ctx, &last_completed, &last_submitted);
+
+	free(ctx->free_slots);
+	free(ctx->slot_req);
+	/* Left for process_results to merge */
+	shared_ctx->lat = ctx->lat;
+	shared_ctx->stale_reads = ctx->stale_reads;
+	if (ctx != shared_ctx)
+		free(ctx);
+	return NULL;
 }
 
 /*
@@ -369,26 +752,28 @@ void *thread_function(void *arg)
 void start_threads()
 {
 	int reqs_per_th = num_requests / num_threads;
-	struct request *r = requests;
-	struct buffer_descriptor *rs = results;
 
 	for (int i = 0; i < num_threads; i++)
 	{
 		contexts[i].tid = i;
 		contexts[i].num_reqs = reqs_per_th;
-		contexts[i].reqs = r;
+		contexts[i].reqs = requests + (uint64_t)i * reqs_per_th;
 		contexts[i].win_size = win_size;
-		contexts[i].comps = (struct buffer_descriptor *)(shmem_area + sizeof(struct ring) + i * win_size * sizeof(struct buffer_descriptor));
-		contexts[i].res = rs;
+		contexts[i].comps = (struct buffer_descriptor *)(shmem_area + board_off + i * win_size * sizeof(struct buffer_descriptor));
+		contexts[i].res = results != NULL ? results + (uint64_t)i * reqs_per_th : NULL;
 		/* This is the byte offset to the first window for this thread */
-		contexts[i].comp_off = sizeof(struct ring) + contexts[i].tid * win_size * sizeof(struct buffer_descriptor);
+		contexts[i].comp_off = board_off + contexts[i].tid * win_size * sizeof(struct buffer_descriptor);
+		contexts[i].sq = sharded ? &shards[i] : NULL;
+		contexts[i].cq = out_of_order ? (struct ring *)(shmem_area + cqs_off) + i : NULL;
+		contexts[i].payload_off = has_multi ? payloads_off + i * win_size * sizeof(struct multi_payload) : 0;
+		contexts[i].payloads = has_multi ? (struct multi_payload *)(shmem_area + contexts[i].payload_off) : NULL;
+		contexts[i].blob_off = has_blobs ? blobs_off + i * win_size * blob_slot : 0;
+		contexts[i].blobs = has_blobs ? shmem_area + contexts[i].blob_off : NULL;
+		contexts[i].bell_off = event_driven ? bells_off + i * sizeof(struct completion_bell) : 0;
+		contexts[i].bell = event_driven ? (struct completion_bell *)(shmem_area + contexts[i].bell_off) : NULL;
 
 		if (pthread_create(&threads[i], NULL, &thread_function, &contexts[i]))
 			perror("pthread_create");
-
-		/* Each thread is only responsible for an equal part of requests */
-		r += reqs_per_th;
-		rs += reqs_per_th;
 	}
 }
 
@@ -401,13 +786,28 @@ void wait_for_threads()
 
 void usage(char *name)
 {
-	printf("Usage: %s [-h] [-n num_threads] [-w win_size] [-v] [-t kv_store_threads] [-s init_table_size] [-f]\n", name);
+	printf("Usage: %s [-h] [-n num_threads] [-w win_size] [-v] [-t kv_store_threads] [-s init_table_size] [-b burst_size] [-k backend] [-a server_args] [-r] [-P] [-E] [-O] [-L] [--ttl ms] [--arena-mb n] [--attach file] [--cpus list] [--affinity mode] [--huge] [--memfd] [-f]\n", name);
 	printf("-h show this help\n");
 	printf("-n specify the number of threads\n");
 	printf("-w specify the window size (max distance between last submitted request and last completed request\n");
 	printf("-v give verbose output if set\n");
 	printf("-t number of threads in the kv_store program (ignored if -f is not set)\n");
 	printf("-s initial_table_size in the kv_store program (ignored if -f is not set)\n");
+	printf("-b max requests the kv_store program dequeues per wakeup (ignored if -f is not set)\n");
+	printf("-k KV store backend of the kv_store program: chain or bucket (ignored if -f is not set)\n");
+	printf("-a extra arguments for the kv_store program, e.g. -a \"-l striped -c 64\" (ignored if -f is not set)\n");
+	printf("-r if set, every thread submits to its own single-producer ring instead of the shared one\n");
+	printf("-P if set, route each request to the kv_store thread that owns its key's partition (one partition per '-t' thread, no locking in the server)\n");
+	printf("-O if set, the server posts completions to a per-thread ring and threads reap them in any order, so a slow request doesn't hold up the rest of the window (-w at most %d)\n", RING_SIZE);
+	printf("-E if set, threads sleep until the server signals a completion instead of busy-polling the board\n");
+	printf("-L if set, timestamp every request and print latency percentiles, split into time in the ring (queue), in the server (service) and until the client noticed the completion (notify)\n");
+	printf("--ttl keys of puts expire after this many ms if the server runs as a cache (-a \"--cache n\")\n");
+	printf("--arena-mb MiB of shared memory for the server to keep vput values in, if the workload has vput/vget requests (default: 64)\n");
+	printf("--cpus pin client thread i to the i-th CPU of a list such as 0-3,8 (wraps around)\n");
+	printf("--affinity none (default) or auto - pin client threads to alternate cores of each LLC; also passed to the kv_store program if -f is set\n");
+	printf("--huge back the shared region with 2 MiB pages (hugetlb with --memfd if reserved, transparent huge pages otherwise)\n");
+	printf("--memfd keep the shared region in an anonymous memfd instead of ./%s - requires -f\n", shm_file);
+	printf("--attach run against a server started with --listen file, which keeps its table across client runs\n");
 	printf("-f if set, forks the kv_store program as the child process - '-t' and '-s' options are only effective if this is set\n");
 	printf("-c if set, checks the result of get queries - only works if -n 1 and -w 1 (synchronus submission)\n");
 	printf("-l input workload file name (default: workload.txt)\n");
@@ -422,8 +822,19 @@ static int parse_args(int argc, char **argv)
 	strcpy(expected_file, "solution.txt");
 	strcpy(server_exec, "./server");
 
+	static struct option long_opts[] = {
+		{"cpus", required_argument, NULL, 'C'},
+		{"affinity", required_argument, NULL, 'A'},
+		{"huge", no_argument, NULL, 'H'},
+		{"memfd", no_argument, NULL, 'M'},
+		{"attach", required_argument, NULL, 'T'},
+		{"arena-mb", required_argument, NULL, 'V'},
+		{"ttl", required_argument, NULL, 'Z'},
+		{NULL, 0, NULL, 0}};
+	char *cpu_list = NULL;
+
 	int op;
-	while ((op = getopt(argc, argv, "hn:w:vt:s:fce:i:x:")) != -1)
+	while ((op = getopt_long(argc, argv, "hn:w:vt:s:b:k:a:rPEOLfce:i:x:", long_opts, NULL)) != -1)
 	{
 		switch (op)
 		{
@@ -452,6 +863,38 @@ static int parse_args(int argc, char **argv)
 			s_init_table_size = atoi(optarg);
 			break;
 
+		case 'b':
+			s_burst_size = atoi(optarg);
+			break;
+
+		case 'k':
+			strncpy(s_backend, optarg, sizeof(s_backend) - 1);
+			break;
+
+		case 'a':
+			strncpy(s_extra_args, optarg, sizeof(s_extra_args) - 1);
+			break;
+
+		case 'r':
+			sharded = 1;
+			break;
+
+		case 'P':
+			partitioned = 1;
+			break;
+
+		case 'O':
+			out_of_order = 1;
+			break;
+
+		case 'E':
+			event_driven = 1;
+			break;
+
+		case 'L':
+			trace_latency = 1;
+			break;
+
 		case 'f':
 			do_fork = 1;
 			break;
@@ -472,11 +915,78 @@ static int parse_args(int argc, char **argv)
 			strncpy(server_exec, optarg, 256);
 			break;
 
+		case 'C':
+			cpu_list = optarg;
+			break;
+
+		case 'A':
+			affinity_mode = optarg;
+			break;
+
+		case 'H':
+			shm_flags |= SHM_HUGE;
+			break;
+
+		case 'M':
+			shm_flags |= SHM_MEMFD;
+			break;
+
+		case 'T':
+			attach_path = optarg;
+			break;
+
+		case 'V':
+			arena_mb = atoi(optarg);
+			break;
+
+		case 'Z':
+			ttl_ms = strtoul(optarg, NULL, 10);
+			break;
+
 		default:
 			usage(argv[0]);
 			return 1;
 		}
 	}
+	if (affinity_init(&affinity, cpu_list, affinity_mode, AFFINITY_CLIENT) < 0)
+		return 1;
+	if (num_threads < 1 || num_threads > MAX_THREADS || win_size < 1)
+	{
+		fprintf(stderr, "-n must be between 1 and %d and -w positive\n", MAX_THREADS);
+		return 1;
+	}
+	if (out_of_order && (win_size < 1 || win_size > RING_SIZE))
+	{
+		/* More in flight could fill the completion ring while this thread
+		 * is itself blocked submitting, and deadlock with the server */
+		fprintf(stderr, "-O needs a window size between 1 and %d\n", RING_SIZE);
+		return 1;
+	}
+	if (attach_path != NULL && (do_fork || sharded || partitioned || (shm_flags & SHM_MEMFD)))
+	{
+		fprintf(stderr, "--attach can't be combined with -f, -r, -P or --memfd\n");
+		return 1;
+	}
+	if (arena_mb < 1 || arena_mb > 2047)
+	{
+		fprintf(stderr, "--arena-mb must be between 1 and 2047\n");
+		return 1;
+	}
+	if (sharded && partitioned)
+	{
+		fprintf(stderr, "-r and -P can't be combined\n");
+		return 1;
+	}
+	if (partitioned && (s_num_threads < 1 || s_num_threads > MAX_THREADS))
+	{
+		fprintf(stderr, "-P needs between 1 and %d kv_store threads (-t)\n", MAX_THREADS);
+		return 1;
+	}
+	if ((shm_flags & SHM_MEMFD) && !do_fork)
+	{
+		fprintf(stderr, "--memfd requires -f: only a forked server can inherit the memfd\n");
+		return 1;
+	}
 	return 0;
 }
 
@@ -506,7 +1016,7 @@ void read_expected_file(FILE *f, value_type *exp)
 		if (feof(f))
 			break;
 
-		exp[idx++] = atoi(line);
+		exp[idx++] = strtoul(line, NULL, 10);
 	}
 }
 
@@ -519,18 +1029,45 @@ void read_expected_file(FILE *f, value_type *exp)
 int check_results(value_type *expected)
 {
 	int exp_idx = 0;
-	for (int i = 0; i < num_requests; i++)
+	/* Only the requests handed to a thread were submitted, and checked
+	 * (see workload_check) */
+	uint64_t submitted = num_requests / num_threads * num_threads;
+	for (uint64_t i = 0; i < submitted; i++)
 	{
-		/* Only interested in GET requests */
-		if (requests[i].t != GET)
+		/* An MGET has one expected value per key */
+		if (requests[i].t == MGET)
+		{
+			for (uint32_t j = requests[i].v; j < requests[i].v + requests[i].k; j++, exp_idx++)
+			{
+				if (mget_results[j] != expected[exp_idx])
+				{
+					fprintf(stderr, "Mget(%u) should return %u, but got %u\n",
+							workload.keys[j], expected[exp_idx], mget_results[j]);
+					fprintf(stderr, "Indices: req=%lu key=%u exp=%d\n", i, j - requests[i].v, exp_idx);
+					return 1;
+				}
+			}
+			continue;
+		}
+
+		/* Only interested in GET requests, and VGETs, whose expected
+		 * value is the checksum of the value */
+		if (requests[i].t != GET && requests[i].t != VGET)
 			continue;
 
 		/* Mismatch! */
+		if (results[i].v != expected[exp_idx] && requests[i].t == VGET)
+		{
+			fprintf(stderr, "Vget(%s) should return a value with checksum %u, but got %u\n",
+					workload.bytes + requests[i].k, expected[exp_idx], results[i].v);
+			fprintf(stderr, "Indices: req=%lu exp=%d\n", i, exp_idx);
+			return 1;
+		}
 		if (results[i].v != expected[exp_idx])
 		{
 			fprintf(stderr, "Get(%u) should return %u, but got %u\n",
 					results[i].k, expected[exp_idx], results[i].v);
-			fprintf(stderr, "Indices: req=%d exp=%d\n", i, exp_idx);
+			fprintf(stderr, "Indices: req=%lu exp=%d\n", i, exp_idx);
 			return 1;
 		}
 		exp_idx++;
@@ -571,6 +1108,22 @@ int process_results(struct timespec *s, struct timespec *e)
 	double tput = (num_requests * 1e6) / ns;
 	printf("Total time: %f ms\nThroughput: %f K/s\n", ns / 1e6, tput);
 
+	uint64_t stale = 0;
+	for (int i = 0; i < num_threads; i++)
+		stale += contexts[i].stale_reads;
+	if (stale > 0)
+		printf("%lu vget replies were overwritten before they were read\n", (unsigned long)stale);
+
+	if (trace_latency)
+	{
+		struct latency_stats *all = calloc(1, sizeof(struct latency_stats));
+		for (int i = 0; i < num_threads && all != NULL; i++)
+			if (contexts[i].lat != NULL)
+				latency_merge(all, contexts[i].lat);
+		if (all != NULL)
+			latency_print(all);
+	}
+
 	/* No errors in check results */
 	return 0;
 }
@@ -580,9 +1133,15 @@ int main(int argc, char *argv[])
 	if (parse_args(argc, argv) != 0)
 		exit(EXIT_FAILURE);
 
-	init_client();
-
+	/* The workload decides whether the shared region needs MGET/MPUT payloads */
 	read_input_files();
+	if (partitioned && has_multi)
+	{
+		fprintf(stderr, "-P can't route mget/mput requests, whose keys span partitions\n");
+		exit(EXIT_FAILURE);
+	}
+
+	init_client();
 
 	struct timespec s, e;
 	clock_gettime(CLOCK_REALTIME, &s);
@@ -590,11 +1149,18 @@ int main(int argc, char *argv[])
 	start_threads();
 	wait_for_threads();
 
+	/* Every request has completed, so the server is done with our slot */
+	if (attach_slot >= 0)
+		registry_detach(registry, attach_slot);
+
 	clock_gettime(CLOCK_REALTIME, &e);
 
-	/* Kill the server app */
-	if (child_pid > 0)
-		kill(child_pid, SIGKILL);
+	/* Stop the server app - a server with --snapshot writes its keys out
+	 * before exiting, so wait for it */
+	if (child_pid > 0) {
+		kill(child_pid, SIGTERM);
+		waitpid(child_pid, NULL, 0);
+	}
 
 	return process_results(&s, &e);
 }
@@ -8,3 +8,10 @@ typedef uint32_t index_t;
 static index_t hash_function(key_type k, int table_size) {
 	return k % table_size;
 }
+
+/* Which of n partitions owns k in partitioned mode. Multiplicative rather
+ * than k % n, so the keys of one partition still spread over every bucket
+ * of that partition's table when n and the table size share factors */
+static index_t partition_of(key_type k, int n) {
+	return (index_t)(((uint64_t)(k * 2654435761u) * n) >> 32);
+}
@@ -0,0 +1,559 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ring_buffer.h"
+#include "workload.h"
+#include "blob.h"
+
+#define MIN_VALUE 1
+#define MAX_VALUE 4000000000u
+#define OUT_BUF_SIZE (1 << 20)
+// Terms of the zipf normalization summed exactly, the tail is integrated
+#define ZETA_EXACT_TERMS 1000000
+// Keys of vput/vget requests are this prefix followed by the key number
+#define BLOB_KEY_PREFIX "user"
+
+enum key_dist
+{
+    DIST_UNIFORM,
+    DIST_ZIPF,
+    DIST_HOTSET,
+    DIST_LATEST,
+    DIST_SEQUENTIAL
+};
+
+static const char *dist_names[] = {"uniform", "zipf", "hotset", "latest", "sequential"};
+
+uint64_t num_requests = 100;
+uint64_t num_keys = 0; // Defaults to num_requests
+double put_ratio = 0.5;
+double del_ratio = 0;
+enum key_dist dist = DIST_UNIFORM;
+double skew = 0.99;
+double hot_keys = 0.2;
+double hot_ops = 0.8;
+uint64_t seed = 1;
+uint32_t blob_max = 0; // Write vput/vget requests with values of up to this many bytes
+int binary = 0;
+const char *out_file = NULL;
+const char *solution_file = "solution.txt";
+
+// splitmix64: small, fast and identical on every platform
+static uint64_t rng_state;
+
+static uint64_t rng_next(void)
+{
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static double rng_double(void)
+{
+    return (rng_next() >> 11) * 0x1.0p-53;
+}
+
+// Uniform in [0, n), n < 2^32
+static uint64_t rng_below(uint64_t n)
+{
+    return ((rng_next() >> 32) * n) >> 32;
+}
+
+// Zipf ranks over [0, n), P(rank r) proportional to (r + 1)^-theta
+// For theta in (0, 1), after Gray et al., "Quickly generating billion-record
+// synthetic databases"; for theta >= 1, where Gray's method breaks down, by
+// rejection-inversion after Hormann and Derflinger, "Rejection-inversion to
+// generate variates from monotone discrete distributions"
+static struct
+{
+    uint64_t n;
+    double theta, alpha, zetan, eta, half_pow; // Gray
+    double h_x1, h_n, s;                       // Rejection-inversion
+} zipf;
+
+// (e^x - 1) / x and log(1 + x) / x, without cancellation near 0
+static double expm1_x(double x)
+{
+    return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x / 2 * (1 + x / 3);
+}
+
+static double log1p_x(double x)
+{
+    return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x / 3);
+}
+
+// x^-theta, its integral from 1 and the inverse of that integral
+static double zipf_h(double x)
+{
+    return exp(-zipf.theta * log(x));
+}
+
+static double zipf_hint(double x)
+{
+    double lx = log(x);
+    return expm1_x((1 - zipf.theta) * lx) * lx;
+}
+
+static double zipf_hint_inv(double x)
+{
+    double t = x * (1 - zipf.theta);
+    if (t < -1)
+        t = -1; // Only reached through rounding
+    return exp(log1p_x(t) * x);
+}
+
+static double zeta(uint64_t n, double theta)
+{
+    double sum = 0;
+    uint64_t exact = n < ZETA_EXACT_TERMS ? n : ZETA_EXACT_TERMS;
+    for (uint64_t i = 1; i <= exact; i++)
+        sum += pow(i, -theta);
+    // Euler-Maclaurin for the rest, accurate to well below a rank
+    if (n > exact)
+        sum += (pow(n, 1 - theta) - pow(exact, 1 - theta)) / (1 - theta) +
+               (pow(n, -theta) - pow(exact, -theta)) / 2;
+    return sum;
+}
+
+static void zipf_init(uint64_t n, double theta)
+{
+    zipf.n = n;
+    zipf.theta = theta;
+    if (theta >= 1)
+    {
+        zipf.h_x1 = zipf_hint(1.5) - 1;
+        zipf.h_n = zipf_hint(n + 0.5);
+        zipf.s = 2 - zipf_hint_inv(zipf_hint(2.5) - zipf_h(2));
+        return;
+    }
+    zipf.alpha = 1 / (1 - theta);
+    zipf.zetan = zeta(n, theta);
+    zipf.half_pow = pow(0.5, theta);
+    double zeta2 = 1 + zipf.half_pow;
+    zipf.eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zipf.zetan);
+}
+
+// Draw x from the continuous hat over [0.5, n + 0.5] and accept its nearest
+// integer k if x falls under the histogram bar of k - about one try per rank
+static uint64_t zipf_next_heavy(void)
+{
+    while (1)
+    {
+        double u = zipf.h_n + rng_double() * (zipf.h_x1 - zipf.h_n);
+        double x = zipf_hint_inv(u);
+        uint64_t k = x + 0.5;
+        if (k < 1)
+            k = 1;
+        else if (k > zipf.n)
+            k = zipf.n;
+        if (k - x <= zipf.s || u >= zipf_hint(k + 0.5) - zipf_h(k))
+            return k - 1;
+    }
+}
+
+static uint64_t zipf_next(void)
+{
+    if (zipf.theta >= 1)
+        return zipf_next_heavy();
+    double u = rng_double();
+    double uz = u * zipf.zetan;
+    if (uz < 1)
+        return 0;
+    if (uz < 1 + zipf.half_pow)
+        return 1;
+    uint64_t rank = zipf.n * pow(zipf.eta * u - zipf.eta + 1, zipf.alpha);
+    return rank < zipf.n ? rank : zipf.n - 1;
+}
+
+// Pick the key of request i, keys are 1..num_keys
+static key_type next_key(uint64_t i, int is_put, uint64_t *inserted)
+{
+    switch (dist)
+    {
+    case DIST_ZIPF:
+        return zipf_next() + 1;
+
+    case DIST_HOTSET:
+    {
+        uint64_t nhot = num_keys * hot_keys;
+        if (nhot == 0)
+            nhot = 1;
+        if (nhot == num_keys || rng_double() < hot_ops)
+            return rng_below(nhot) + 1;
+        return nhot + rng_below(num_keys - nhot) + 1;
+    }
+
+    case DIST_LATEST:
+    {
+        // PUTs insert the next key, GETs and DELs favour the most recently inserted
+        if (is_put)
+            return (*inserted)++ % num_keys + 1;
+        if (*inserted == 0)
+            return rng_below(num_keys) + 1;
+        uint64_t live = *inserted < num_keys ? *inserted : num_keys;
+        return (*inserted - 1 - zipf_next() % live) % num_keys + 1;
+    }
+
+    case DIST_SEQUENTIAL:
+        return i % num_keys + 1;
+
+    default:
+        return rng_below(num_keys) + 1;
+    }
+}
+
+// Buffered output, formatted by hand: printf dominates the run time otherwise
+struct out
+{
+    FILE *f;
+    char *buf;
+    size_t len;
+};
+
+static void out_flush(struct out *o)
+{
+    if (fwrite(o->buf, 1, o->len, o->f) != o->len)
+    {
+        perror("fwrite");
+        exit(EXIT_FAILURE);
+    }
+    o->len = 0;
+}
+
+static void out_bytes(struct out *o, const void *p, size_t n)
+{
+    if (o->len + n > OUT_BUF_SIZE)
+        out_flush(o);
+    memcpy(o->buf + o->len, p, n);
+    o->len += n;
+}
+
+static void out_uint(struct out *o, uint32_t x, char end)
+{
+    char tmp[11];
+    int n = sizeof(tmp);
+    tmp[--n] = end;
+    do
+    {
+        tmp[--n] = '0' + x % 10;
+        x /= 10;
+    } while (x > 0);
+    out_bytes(o, tmp + n, sizeof(tmp) - n);
+}
+
+static void out_open(struct out *o, const char *path)
+{
+    o->f = fopen(path, "w");
+    o->buf = malloc(OUT_BUF_SIZE);
+    o->len = 0;
+    if (o->f == NULL || o->buf == NULL)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void out_close(struct out *o)
+{
+    out_flush(o);
+    if (fclose(o->f) != 0)
+    {
+        perror("fclose");
+        exit(EXIT_FAILURE);
+    }
+    free(o->buf);
+}
+
+static int digits(uint64_t x)
+{
+    int n = 1;
+    while (x >= 10)
+    {
+        x /= 10;
+        n++;
+    }
+    return n;
+}
+
+// Byte offset of the key string of each key number in the byte area, with
+// the area's total size in key_off[num_keys + 1]
+static uint32_t *blob_key_offsets(void)
+{
+    uint32_t *key_off = malloc((num_keys + 2) * sizeof(uint32_t));
+    if (key_off == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t off = 0;
+    for (uint64_t k = 1; k <= num_keys + 1; k++)
+    {
+        key_off[k] = off;
+        off += sizeof(BLOB_KEY_PREFIX) + digits(k);
+    }
+    return key_off;
+}
+
+static void out_blob_key(struct out *o, uint64_t k, char end)
+{
+    out_bytes(o, BLOB_KEY_PREFIX, sizeof(BLOB_KEY_PREFIX) - 1);
+    out_uint(o, k, end);
+}
+
+static void generate(void)
+{
+    // Last value PUT for each key, to write the expected GET results
+    value_type *store = calloc(num_keys + 1, sizeof(value_type));
+    if (store == NULL)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    // With -V, values are generated and only their checksums are kept
+    uint32_t *key_off = blob_max > 0 ? blob_key_offsets() : NULL;
+    char *value = blob_max > 0 ? malloc(blob_max) : NULL;
+    if (blob_max > 0 && value == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    struct out wl, sol;
+    out_open(&wl, out_file);
+    out_open(&sol, solution_file);
+    if (binary)
+    {
+        struct workload_header h = {
+            .magic = WORKLOAD_MAGIC,
+            .version = WORKLOAD_VERSION,
+            .num_requests = num_requests,
+            .num_keys = 0,
+            .num_bytes = key_off != NULL ? key_off[num_keys + 1] : 0,
+            .max_blob = key_off != NULL ? sizeof(BLOB_KEY_PREFIX) - 1 + digits(num_keys) + blob_max : 0,
+        };
+        out_bytes(&wl, &h, sizeof(h));
+    }
+
+    uint64_t inserted = 0;
+    for (uint64_t i = 0; i < num_requests; i++)
+    {
+        double op = rng_double();
+        int is_put = op < put_ratio;
+        struct request r = {.t = is_put ? PUT : op < put_ratio + del_ratio ? DEL : GET};
+        r.k = next_key(i, is_put, &inserted);
+        if (key_off != NULL)
+        {
+            key_type k = r.k;
+            r.t = is_put ? VPUT : VGET;
+            r.k = key_off[k];
+            if (is_put)
+            {
+                r.v = 1 + rng_below(blob_max);
+                blob_fill(value, r.v, i);
+                store[k] = blob_hash(value, r.v);
+            }
+            else
+                out_uint(&sol, store[k], '\n');
+
+            if (binary)
+                out_bytes(&wl, &r, sizeof(r));
+            else
+            {
+                out_bytes(&wl, is_put ? "vput " : "vget ", 5);
+                out_blob_key(&wl, k, is_put ? ' ' : '\n');
+                if (is_put)
+                    out_uint(&wl, r.v, '\n');
+            }
+            continue;
+        }
+        if (is_put)
+        {
+            r.v = MIN_VALUE + rng_below(MAX_VALUE - MIN_VALUE);
+            store[r.k] = r.v;
+        }
+        else if (r.t == DEL)
+            store[r.k] = 0;
+        else
+            out_uint(&sol, store[r.k], '\n');
+
+        if (binary)
+            out_bytes(&wl, &r, sizeof(r));
+        else if (is_put)
+        {
+            out_bytes(&wl, "put ", 4);
+            out_uint(&wl, r.k, ' ');
+            out_uint(&wl, r.v, '\n');
+        }
+        else
+        {
+            out_bytes(&wl, r.t == DEL ? "del " : "get ", 4);
+            out_uint(&wl, r.k, '\n');
+        }
+    }
+
+    // The key strings, after the (empty) key and value areas
+    for (uint64_t k = 1; binary && key_off != NULL && k <= num_keys; k++)
+        out_blob_key(&wl, k, '\0');
+
+    out_close(&wl);
+    out_close(&sol);
+    free(store);
+    free(key_off);
+    free(value);
+}
+
+void usage(char *name)
+{
+    printf("Usage: %s [-h] [-n num_requests] [-k num_keys] [-r put_ratio] [-D del_ratio] [-d distribution] [-s skew] [--hot-keys fraction] [--hot-ops fraction] [-S seed] [-V max_value_len] [-b] [-o file] [-e file]\n", name);
+    printf("-h show this help\n");
+    printf("-n number of requests (default: 100)\n");
+    printf("-k keys are drawn from 1..num_keys (default: num_requests)\n");
+    printf("-r fraction of requests that are puts (default: 0.5)\n");
+    printf("-D fraction of requests that are dels, taken from the gets (default: 0)\n");
+    printf("-d key distribution: uniform (default), zipf, hotset, latest (gets and dels favour recently put keys, puts insert new ones) or sequential\n");
+    printf("-s zipf skew for -d zipf and latest, any positive exponent: key rank r is drawn with probability proportional to r^-skew, so values above 1 match gen_workload.py (default: 0.99)\n");
+    printf("--hot-keys fraction of the keys in the hot set for -d hotset (default: 0.2)\n");
+    printf("--hot-ops fraction of the requests that go to the hot set for -d hotset (default: 0.8)\n");
+    printf("-S random seed, the same seed and options always give the same workload (default: 1)\n");
+    printf("-V write vput/vget requests instead of put/get, with keys " BLOB_KEY_PREFIX "1.." BLOB_KEY_PREFIX "<num_keys> and values of 1 to max_value_len bytes (at most %d); the solution holds checksums of the values\n", BLOB_MAX_VALUE);
+    printf("-b write the binary workload format (see workload.h) instead of text\n");
+    printf("-o workload file (default: workload.txt, or workload.bin with -b)\n");
+    printf("-e file with the expected result of every get (default: solution.txt)\n");
+}
+
+static int parse_args(int argc, char **argv)
+{
+    static struct option long_opts[] = {
+        {"hot-keys", required_argument, NULL, 'K'},
+        {"hot-ops", required_argument, NULL, 'O'},
+        {NULL, 0, NULL, 0}};
+
+    int op;
+    while ((op = getopt_long(argc, argv, "hn:k:r:D:d:s:S:V:bo:e:", long_opts, NULL)) != -1)
+    {
+        switch (op)
+        {
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+            break;
+
+        case 'n':
+            num_requests = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'k':
+            num_keys = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'r':
+            put_ratio = atof(optarg);
+            break;
+
+        case 'D':
+            del_ratio = atof(optarg);
+            break;
+
+        case 'd':
+        {
+            size_t i;
+            for (i = 0; i < sizeof(dist_names) / sizeof(dist_names[0]); i++)
+                if (!strcmp(optarg, dist_names[i]))
+                    break;
+            if (i == sizeof(dist_names) / sizeof(dist_names[0]))
+            {
+                fprintf(stderr, "Unknown distribution %s\n", optarg);
+                return -1;
+            }
+            dist = i;
+            break;
+        }
+
+        case 's':
+            skew = atof(optarg);
+            break;
+
+        case 'K':
+            hot_keys = atof(optarg);
+            break;
+
+        case 'O':
+            hot_ops = atof(optarg);
+            break;
+
+        case 'S':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'V':
+            blob_max = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'b':
+            binary = 1;
+            break;
+
+        case 'o':
+            out_file = optarg;
+            break;
+
+        case 'e':
+            solution_file = optarg;
+            break;
+
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (num_keys == 0)
+        num_keys = num_requests > 0 ? num_requests : 1;
+    if (num_keys > UINT32_MAX)
+    {
+        fprintf(stderr, "-k is at most %u\n", UINT32_MAX);
+        return -1;
+    }
+    if (blob_max > BLOB_MAX_VALUE)
+    {
+        fprintf(stderr, "-V is at most %d\n", BLOB_MAX_VALUE);
+        return -1;
+    }
+    if (blob_max > 0 && del_ratio > 0)
+    {
+        fprintf(stderr, "-V and -D can't be combined: there is no request to delete a vput key\n");
+        return -1;
+    }
+    if (blob_max > 0 && num_keys > 100000000)
+    {
+        // The key strings must fit the 4 GiB byte area
+        fprintf(stderr, "-V supports at most 100000000 keys\n");
+        return -1;
+    }
+    if (!(skew > 0) || isinf(skew))
+    {
+        fprintf(stderr, "-s must be positive\n");
+        return -1;
+    }
+    if (out_file == NULL)
+        out_file = binary ? "workload.bin" : "workload.txt";
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (parse_args(argc, argv) != 0)
+        exit(EXIT_FAILURE);
+
+    rng_state = seed;
+    if (dist == DIST_ZIPF || dist == DIST_LATEST)
+        zipf_init(num_keys, skew);
+    generate();
+    printf("Workload generated and saved to %s\n", out_file);
+    return 0;
+}
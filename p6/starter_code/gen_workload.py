@@ -11,8 +11,8 @@ put 4 8
 get 3
 get 4
 
-We should be able to control the skew (zipf distribution), ratio of put/get requests, and the number of requests. So the call would look like the following:
-./script -n num_reqs -s skew -r ratio_put_get
+We should be able to control the skew (zipf distribution), ratio of put/get requests, ratio of del requests, and the number of requests. So the call would look like the following:
+./script -n num_reqs -s skew -r ratio_put_get -D ratio_del
 """
 
 import argparse
@@ -25,9 +25,10 @@ min_value = 1
 max_value = int(4e9)
 
 
-def generate_workload(num_reqs, skew, ratio_put_get):
+def generate_workload(num_reqs, skew, ratio_put_get, ratio_del=0):
     num_put = int(num_reqs * ratio_put_get)
-    num_get = num_reqs - num_put
+    num_del = min(int(num_reqs * ratio_del), num_reqs - num_put)
+    num_get = num_reqs - num_put - num_del
     # Generate the keys
     if skew >= 0 and skew <= 1:  # Uniform distribution
         keys = list(range(1, num_put + 1))
@@ -43,17 +44,27 @@ def generate_workload(num_reqs, skew, ratio_put_get):
     # Replace zeros with non-zero values
     values = [v if v != 0 else 1 for v in values]
     # Generate the requests
-    n, m = 0, 0
+    n, m, d = 0, 0, 0
     requests = []
     while True:
-        if random.random() < ratio_put_get and n < num_put:
+        r = random.random()
+        if r < ratio_put_get and n < num_put:
             requests.append("put " + str(keys[n]) + " " + str(values[n]))
             n += 1
+        elif r < ratio_put_get + ratio_del and d < num_del:
+            # Delete one of the keys written so far
+            i = random.randint(0, max(n, 1) - 1)
+            requests.append("del " + str(keys[i]))
+            d += 1
         elif m < num_get:
             i = random.randint(0, num_put - 1)
             requests.append("get " + str(keys[i]))
             m += 1
-        if n == num_put and m == num_get:
+        elif d < num_del:
+            i = random.randint(0, max(n, 1) - 1)
+            requests.append("del " + str(keys[i]))
+            d += 1
+        if n == num_put and m == num_get and d == num_del:
             break
     return requests
 
@@ -68,8 +79,9 @@ def main():
         help="Skew [0, 1] for uniform distribution, >1 for zipf distribution",
     )
     parser.add_argument("-r", type=float, default=0.5, help="Ratio of put/get requests")
+    parser.add_argument("-D", type=float, default=0, help="Ratio of del requests, taken from the gets (same flag as gen_workload)")
     args = parser.parse_args()
-    requests = generate_workload(args.n, args.s, args.r)
+    requests = generate_workload(args.n, args.s, args.r, args.D)
     with open("workload.txt", "w") as f:
         for i, request in enumerate(requests):
             f.write(request + "\n")
@@ -82,6 +94,9 @@ def main():
             if req[0] == "put":
                 kvstore[req[1]] = req[2]
                 continue
+            if req[0] == "del":
+                kvstore.pop(req[1], None)
+                continue
             # get request
             val = 0
             if req[1] in kvstore:
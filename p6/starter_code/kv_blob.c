@@ -0,0 +1,179 @@
+#include "kv_blob.h"
+#include <stdio.h>
+#include <string.h>
+
+// Block sizes are 64 << class, for classes 0 to ARENA_CLASSES - 1
+#define ARENA_MIN_SHIFT 6
+#define ARENA_CLASSES 15
+// Mutexes VPUTs serialize on, picked by key hash
+#define BLOB_WRITE_LOCKS 256
+
+struct arena_class
+{
+    pthread_mutex_t lock;
+    uint32_t free; // Offset of the first free block, linked through next
+} __attribute__((aligned(64)));
+
+bool blob_enabled = false;
+static char *base;
+static uint64_t arena_end;
+static uint64_t bump; // Offset of the first block never handed out
+static struct arena_class classes[ARENA_CLASSES];
+static stripe_lock_t write_locks[BLOB_WRITE_LOCKS];
+static const struct kv_backend *index_kv;
+static kv_table_t *index_table;
+static bool full_reported;
+
+int blob_init(char *region, uint32_t arena_off, uint32_t arena_size, const struct kv_backend *kv,
+              index_t table_size, enum kv_sync sync, uint32_t nstripes)
+{
+    base = region;
+    bump = (arena_off + 63) & ~(uint64_t)63;
+    arena_end = (uint64_t)arena_off + arena_size;
+    for (int i = 0; i < ARENA_CLASSES; i++)
+    {
+        pthread_mutex_init(&classes[i].lock, NULL);
+        classes[i].free = 0;
+    }
+    for (int i = 0; i < BLOB_WRITE_LOCKS; i++)
+        pthread_mutex_init(&write_locks[i].m, NULL);
+
+    // Shared by every server thread, even when their own tables are private
+    index_kv = kv;
+    index_table = kv->create(table_size);
+    if (index_table == NULL || table_set_sync(index_table, sync == SYNC_NONE ? SYNC_SEQLOCK : sync, nstripes) < 0)
+        return -1;
+    blob_enabled = true;
+    return 0;
+}
+
+static inline struct blob_entry *entry(uint32_t off)
+{
+    return (struct blob_entry *)(base + off);
+}
+
+static int size_class(uint32_t bytes)
+{
+    int c = 0;
+    while (c < ARENA_CLASSES && (1u << (ARENA_MIN_SHIFT + c)) < bytes)
+        c++;
+    return c;
+}
+
+// Take a block of class c, its version odd until the caller publishes it
+static uint32_t arena_alloc(int c)
+{
+    struct arena_class *ac = &classes[c];
+    pthread_mutex_lock(&ac->lock);
+    uint32_t off = ac->free;
+    if (off != 0)
+        ac->free = entry(off)->next;
+    pthread_mutex_unlock(&ac->lock);
+    if (off != 0)
+        return off;
+
+    // Only advance the bump pointer for a block that fits, so one large
+    // VPUT that misses does not leave the rest of the arena unusable
+    uint64_t size = 1u << (ARENA_MIN_SHIFT + c);
+    uint64_t start = __atomic_load_n(&bump, __ATOMIC_RELAXED);
+    do
+    {
+        if (start + size > arena_end)
+            return 0;
+    } while (!__atomic_compare_exchange_n(&bump, &start, start + size, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    entry(start)->version = 1;
+    return start;
+}
+
+// Retire a live entry: readers that found it fail validation from now on
+static void arena_free(uint32_t off)
+{
+    struct blob_entry *e = entry(off);
+    int c = size_class(sizeof(struct blob_entry) + e->key_len + e->val_len);
+    __atomic_store_n(&e->version, e->version + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    struct arena_class *ac = &classes[c];
+    pthread_mutex_lock(&ac->lock);
+    e->next = ac->free;
+    ac->free = off;
+    pthread_mutex_unlock(&ac->lock);
+}
+
+static inline bool key_equal(struct blob_entry *e, const char *key, uint32_t key_len)
+{
+    return e->key_len == key_len && memcmp(e->data, key, key_len) == 0;
+}
+
+uint32_t blob_put(uint32_t hash, const char *key, uint32_t key_len, const char *value, uint32_t val_len)
+{
+    // Copied outside the lock - only the chain update is serialized
+    int c = size_class(sizeof(struct blob_entry) + key_len + val_len);
+    uint32_t off = c < ARENA_CLASSES ? arena_alloc(c) : 0;
+    if (off == 0)
+    {
+        if (!__atomic_exchange_n(&full_reported, true, __ATOMIC_RELAXED))
+            fprintf(stderr, "Server: the blob arena is full, dropping VPUTs\n");
+        return 0;
+    }
+    struct blob_entry *e = entry(off);
+    e->key_len = key_len;
+    e->val_len = val_len;
+    memcpy(e->data, key, key_len);
+    memcpy(e->data + key_len, value, val_len);
+
+    pthread_mutex_t *m = &write_locks[hash % BLOB_WRITE_LOCKS].m;
+    pthread_mutex_lock(m);
+    uint32_t head = index_kv->get(index_table, hash);
+    uint32_t prev = 0, cur = head;
+    while (cur != 0 && !key_equal(entry(cur), key, key_len))
+    {
+        prev = cur;
+        cur = entry(cur)->next;
+    }
+
+    // The new entry takes the old one's place in the chain, or its head
+    e->next = cur != 0 ? entry(cur)->next : head;
+    __atomic_store_n(&e->version, e->version + 1, __ATOMIC_RELEASE);
+    if (cur != 0 && prev != 0)
+        __atomic_store_n(&entry(prev)->next, off, __ATOMIC_RELEASE);
+    else
+        index_kv->put(index_table, hash, off);
+    pthread_mutex_unlock(m);
+
+    if (cur != 0)
+        arena_free(cur);
+    return off;
+}
+
+uint32_t blob_get(uint32_t hash, const char *key, uint32_t key_len, uint32_t *version, uint32_t *val_len)
+{
+retry:
+    thread_stats->lookups++;
+    for (uint32_t off = index_kv->get(index_table, hash); off != 0;)
+    {
+        struct blob_entry *e = entry(off);
+        uint32_t v = __atomic_load_n(&e->version, __ATOMIC_ACQUIRE);
+        bool match = !(v & 1) && key_equal(e, key, key_len);
+        uint32_t len = e->val_len;
+        uint32_t next = e->next;
+        thread_stats->probes++;
+
+        // Freed, or reused, while we read it: the chain may have moved on
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((v & 1) || __atomic_load_n(&e->version, __ATOMIC_RELAXED) != v)
+        {
+            thread_stats->read_retries++;
+            goto retry;
+        }
+        if (match)
+        {
+            *version = v;
+            *val_len = len;
+            return off;
+        }
+        off = next;
+    }
+    return 0;
+}
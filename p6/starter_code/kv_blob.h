@@ -0,0 +1,45 @@
+#pragma once
+#include "kv_store.h"
+#include "blob.h"
+
+/*
+ * Server side of VPUT/VGET (see blob.h)
+ *
+ * Entries live in the arena, carved into power-of-two blocks of 64 bytes to
+ * 1 MiB. Each size class has its own free list; fresh blocks come off a
+ * shared bump pointer. A table of the server's backend maps each key hash
+ * to the first entry of its chain. Writers of one hash serialize on one of
+ * a fixed set of mutexes, readers take no lock: they validate each entry's
+ * version after reading it, like a seqlock, and start over if it changed.
+ */
+
+/*
+ * Set up the arena and its index - must be called before any server thread
+ * starts
+ * @param base start of the shared region
+ * @param arena_off, arena_size where the arena is, in bytes from base
+ * @return 0 on success, -1 on failure
+ */
+int blob_init(char *base, uint32_t arena_off, uint32_t arena_size, const struct kv_backend *kv,
+			  index_t table_size, enum kv_sync sync, uint32_t nstripes);
+
+/*
+ * Whether blob_init was called, i.e. the region has an arena
+ */
+extern bool blob_enabled;
+
+/*
+ * Store a copy of key and value, replacing the key's previous entry
+ * @param hash blob_hash of the key
+ * @return offset of the new entry from base, 0 if the arena is full
+ */
+uint32_t blob_put(uint32_t hash, const char *key, uint32_t key_len, const char *value, uint32_t val_len);
+
+/*
+ * Find key's entry
+ * @param version set to the entry's version, for the client to validate
+ * its reads against
+ * @param val_len set to the length of the entry's value
+ * @return offset of the entry from base, 0 if the key is absent
+ */
+uint32_t blob_get(uint32_t hash, const char *key, uint32_t key_len, uint32_t *version, uint32_t *val_len);
@@ -0,0 +1,283 @@
+#include "kv_store.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Keys per 64-byte bucket
+#define BUCKET_SLOTS 6
+#define SLOT_MASK ((1u << BUCKET_SLOTS) - 1)
+// Grow the table once buckets average more than this many keys, so most
+// lookups finish in the home bucket without touching an overflow line
+#define BUCKET_MAX_LOAD 5
+// Lock-free readers revalidate after following this many overflow links
+#define BUCKET_READ_CHECK 8
+
+// One cache line: header, packed keys, packed values and an overflow link
+// Bit i of hdr.meta is set when slot i holds a key. Overflow buckets use
+// the same layout but only the home bucket's lock is ever taken
+typedef struct cl_bucket
+{
+    bucket_hdr_t hdr;
+    key_type keys[BUCKET_SLOTS];
+    value_type values[BUCKET_SLOTS];
+    struct cl_bucket *overflow;
+} __attribute__((aligned(64))) cl_bucket_t;
+
+_Static_assert(sizeof(cl_bucket_t) == 64, "cl_bucket_t must fill exactly one cache line");
+
+// Return a mask with bit i set when keys[i] == key (occupied or not)
+typedef uint32_t (*match_fn)(const cl_bucket_t *b, key_type key);
+
+static uint32_t match_scalar(const cl_bucket_t *b, key_type key)
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < BUCKET_SLOTS; i++)
+        mask |= (uint32_t)(b->keys[i] == key) << i;
+    return mask;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Two 4-lane compares; the upper lanes of the second load read values[0..1],
+// which lie inside the bucket and are masked off below
+__attribute__((target("sse2"))) static uint32_t match_sse2(const cl_bucket_t *b, key_type key)
+{
+    __m128i k = _mm_set1_epi32(key);
+    __m128i lo = _mm_loadu_si128((const __m128i *)b->keys);
+    __m128i hi = _mm_loadu_si128((const __m128i *)(b->keys + 4));
+    uint32_t mlo = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lo, k)));
+    uint32_t mhi = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(hi, k)));
+    return (mlo | (mhi << 4)) & SLOT_MASK;
+}
+
+// One 8-lane compare over keys[0..5] and values[0..1]
+__attribute__((target("avx2"))) static uint32_t match_avx2(const cl_bucket_t *b, key_type key)
+{
+    __m256i k = _mm256_set1_epi32(key);
+    __m256i keys = _mm256_loadu_si256((const __m256i *)b->keys);
+    return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(keys, k))) & SLOT_MASK;
+}
+#endif
+
+// Picked once in bucket_create based on what the CPU supports
+static match_fn match_slots = match_scalar;
+
+// Overflow buckets emptied by this thread's DELs, reused before allocating.
+// Like nodes of the chain backend they are never freed, so a reader that
+// followed a stale overflow link only fails validation
+static __thread cl_bucket_t *free_overflow;
+
+static cl_bucket_t *alloc_overflow(void)
+{
+    cl_bucket_t *b = free_overflow;
+    if (b != NULL)
+        free_overflow = b->overflow;
+    else
+        b = aligned_alloc(64, sizeof(cl_bucket_t));
+    if (b != NULL)
+        memset(b, 0, sizeof(cl_bucket_t));
+    return b;
+}
+
+// Find key in the chain starting at b
+// Returns the bucket holding it and sets *slot, or NULL if it is absent
+static cl_bucket_t *bucket_find(cl_bucket_t *b, key_type key, int *slot)
+{
+    for (; b != NULL; b = b->overflow)
+    {
+        uint32_t hits = match_slots(b, key) & b->hdr.meta & SLOT_MASK;
+        if (hits)
+        {
+            *slot = __builtin_ctz(hits);
+            return b;
+        }
+    }
+    return NULL;
+}
+
+// Store a key known to be absent in the first free slot of the chain
+// Returns -1 if an overflow bucket was needed and could not be allocated
+static int bucket_insert(cl_bucket_t *b, key_type key, value_type value)
+{
+    while (1)
+    {
+        uint32_t free_slots = ~b->hdr.meta & SLOT_MASK;
+        if (free_slots)
+        {
+            int slot = __builtin_ctz(free_slots);
+            b->keys[slot] = key;
+            b->values[slot] = value;
+            __atomic_store_n(&b->hdr.meta, b->hdr.meta | (1u << slot), __ATOMIC_RELEASE);
+            return 0;
+        }
+        if (b->overflow == NULL)
+        {
+            cl_bucket_t *o = alloc_overflow();
+            if (o == NULL)
+                return -1;
+            __atomic_store_n(&b->overflow, o, __ATOMIC_RELEASE); // Publish a zeroed line
+        }
+        b = b->overflow;
+    }
+}
+
+// Re-insert every key of the chain into its bucket in the next array
+// Overflow buckets stay attached to the retired bucket like the array itself
+static uint64_t bucket_migrate(kv_table_t *t, bucket_hdr_t *hdr, table_array_t *to)
+{
+    uint64_t moved = 0;
+    for (cl_bucket_t *b = (cl_bucket_t *)hdr; b != NULL; b = b->overflow)
+    {
+        uint32_t used = b->hdr.meta & SLOT_MASK;
+        while (used)
+        {
+            int slot = __builtin_ctz(used);
+            used &= used - 1;
+            cl_bucket_t *dst = (cl_bucket_t *)array_bucket(t, to, hash_function(b->keys[slot], to->size));
+            if (bucket_insert(dst, b->keys[slot], b->values[slot]) < 0)
+                perror("aligned_alloc");
+            else
+                moved++;
+        }
+        __atomic_store_n(&b->hdr.meta, b->hdr.meta & ~SLOT_MASK, __ATOMIC_RELEASE);
+    }
+    return moved;
+}
+
+static void bucket_visit(bucket_hdr_t *hdr, scan_fn fn, void *arg)
+{
+    for (cl_bucket_t *b = (cl_bucket_t *)hdr; b != NULL; b = b->overflow)
+        for (uint32_t used = b->hdr.meta & SLOT_MASK; used; used &= used - 1)
+            fn(arg, b->keys[__builtin_ctz(used)], b->values[__builtin_ctz(used)]);
+}
+
+static kv_table_t *bucket_create(index_t size)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        match_slots = match_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        match_slots = match_sse2;
+#endif
+
+    kv_table_t *t = malloc(sizeof(kv_table_t));
+    if (t == NULL)
+        return NULL;
+    // -s counts keys; size the first array so it holds that many before growing
+    index_t buckets = (size + BUCKET_MAX_LOAD - 1) / BUCKET_MAX_LOAD;
+    if (table_init(t, buckets, sizeof(cl_bucket_t), BUCKET_MAX_LOAD, bucket_migrate, bucket_visit) < 0)
+    {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+static void bucket_put(kv_table_t *t, key_type key, value_type value)
+{
+    table_migrate_step(t);
+
+    table_array_t *a;
+    cl_bucket_t *home = (cl_bucket_t *)table_lock_bucket(t, key, &a);
+    int slot;
+    cl_bucket_t *b = bucket_find(home, key, &slot);
+    if (b != NULL)
+    {
+        __atomic_store_n(&b->values[slot], value, __ATOMIC_RELAXED);
+        table_unlock_bucket(t, &home->hdr);
+        return;
+    }
+
+    int rc = bucket_insert(home, key, value);
+    table_unlock_bucket(t, &home->hdr);
+    if (rc < 0)
+    {
+        perror("aligned_alloc");
+        return;
+    }
+    table_added(t, a, 1);
+}
+
+// Under SYNC_SEQLOCK this probes the lines without taking the bucket and
+// retries if the bucket version moved while we were reading
+static value_type bucket_get(kv_table_t *t, key_type key)
+{
+    while (1)
+    {
+        uint32_t seq;
+        cl_bucket_t *home = (cl_bucket_t *)table_read_bucket(t, key, &seq);
+        value_type value = 0;
+        int hops = 0;
+        for (cl_bucket_t *b = home; b != NULL; b = __atomic_load_n(&b->overflow, __ATOMIC_ACQUIRE))
+        {
+            // An overflow bucket recycled under us could lead anywhere
+            if (++hops % BUCKET_READ_CHECK == 0 && !table_read_valid(t, &home->hdr, seq))
+                break;
+            thread_stats->probes++;
+            uint32_t hits = match_slots(b, key) & __atomic_load_n(&b->hdr.meta, __ATOMIC_ACQUIRE) & SLOT_MASK;
+            if (hits)
+            {
+                value = __atomic_load_n(&b->values[__builtin_ctz(hits)], __ATOMIC_RELAXED);
+                break;
+            }
+        }
+        if (table_read_done(t, &home->hdr, seq))
+        {
+            thread_stats->lookups++;
+            return value;
+        }
+    }
+}
+
+// Remove key and fill its slot with the last key of the chain, so every
+// bucket but the last stays full and an overflow bucket is released as soon
+// as it empties
+static void bucket_del(kv_table_t *t, key_type key)
+{
+    table_array_t *a;
+    cl_bucket_t *home = (cl_bucket_t *)table_lock_bucket(t, key, &a);
+    int slot;
+    cl_bucket_t *b = bucket_find(home, key, &slot);
+    if (b == NULL)
+    {
+        table_unlock_bucket(t, &home->hdr);
+        return;
+    }
+
+    cl_bucket_t *prev = NULL, *tail = home;
+    while (tail->overflow != NULL)
+    {
+        prev = tail;
+        tail = tail->overflow;
+    }
+    uint32_t used = tail->hdr.meta & SLOT_MASK;
+    int last = used ? 31 - __builtin_clz(used) : slot;
+    if (used && (tail != b || last != slot))
+    {
+        b->keys[slot] = tail->keys[last];
+        b->values[slot] = tail->values[last];
+    }
+    else
+        tail = b;
+    __atomic_store_n(&tail->hdr.meta, tail->hdr.meta & ~(1u << last), __ATOMIC_RELEASE);
+
+    if (prev != NULL && prev->overflow == tail && (tail->hdr.meta & SLOT_MASK) == 0)
+    {
+        __atomic_store_n(&prev->overflow, NULL, __ATOMIC_RELEASE);
+        tail->overflow = free_overflow;
+        free_overflow = tail;
+    }
+    table_unlock_bucket(t, &home->hdr);
+    table_removed(t, a, 1);
+}
+
+const struct kv_backend bucket_backend = {
+    .name = "bucket",
+    .create = bucket_create,
+    .put = bucket_put,
+    .get = bucket_get,
+    .del = bucket_del,
+};
@@ -0,0 +1,242 @@
+#include "kv_cache.h"
+#include <stdlib.h>
+#include <time.h>
+
+// Mutexes PUTs and DELs serialize on, picked by key
+#define CACHE_KEY_LOCKS 1024
+
+struct cache_slot
+{
+    uint32_t seq;     // Even while the slot is stable, odd while it is locked
+    key_type key;
+    value_type value;
+    uint32_t expires; // cache_clock() when the key expires, 0 if never
+    uint32_t ref;     // CLOCK reference bit, set by GETs and cleared by the hand
+    uint32_t used;
+};
+
+bool cache_enabled = false;
+static struct cache_slot *slots; // Indexed from 1: a table value of 0 means absent
+static uint32_t capacity;
+static uint32_t default_ttl;
+static uint32_t hand;
+static stripe_lock_t key_locks[CACHE_KEY_LOCKS];
+static struct timespec clock_start;
+
+int cache_init(uint32_t max_keys, uint32_t default_ttl_ms)
+{
+    slots = calloc((size_t)max_keys + 1, sizeof(struct cache_slot));
+    if (slots == NULL)
+        return -1;
+    for (int i = 0; i < CACHE_KEY_LOCKS; i++)
+        pthread_mutex_init(&key_locks[i].m, NULL);
+    capacity = max_keys;
+    default_ttl = default_ttl_ms;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &clock_start);
+    cache_enabled = true;
+    return 0;
+}
+
+// Milliseconds since cache_init, plus one so it is never 0
+// The coarse clock costs a few ns and moves every tick, plenty for TTLs
+static uint32_t cache_clock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (now.tv_sec - clock_start.tv_sec) * 1000 + (now.tv_nsec - clock_start.tv_nsec) / 1000000 + 1;
+}
+
+static inline bool expired(uint32_t expires, uint32_t now)
+{
+    return expires != 0 && (int32_t)(now - expires) >= 0;
+}
+
+static inline pthread_mutex_t *key_lock(key_type key)
+{
+    return &key_locks[hash_function(key, CACHE_KEY_LOCKS)].m;
+}
+
+static bool slot_trylock(struct cache_slot *s)
+{
+    uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) || !__atomic_compare_exchange_n(&s->seq, &seq, seq + 1, false,
+                                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+    // Keep the writes that follow from becoming visible before the odd seq
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return true;
+}
+
+static void slot_lock(struct cache_slot *s)
+{
+    while (!slot_trylock(s))
+    {
+        thread_stats->lock_fails++;
+        cpu_relax();
+    }
+}
+
+static void slot_unlock(struct cache_slot *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Take a slot for a new key, called with that key's lock held
+// The victim's own key lock is only tried: blocking on it while holding a
+// slot could deadlock with its PUT, which may be waiting for the same slot
+// @return the slot's index, locked and empty
+static uint32_t clock_take(const struct kv_backend *kv, kv_table_t *t, key_type key)
+{
+    uint32_t now = cache_clock();
+    while (1)
+    {
+        uint32_t i = __atomic_fetch_add(&hand, 1, __ATOMIC_RELAXED) % capacity + 1;
+        struct cache_slot *s = &slots[i];
+        bool stale = expired(__atomic_load_n(&s->expires, __ATOMIC_RELAXED), now);
+        if (__atomic_load_n(&s->ref, __ATOMIC_RELAXED) && !stale)
+        {
+            __atomic_store_n(&s->ref, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (!slot_trylock(s))
+            continue;
+        if (!s->used)
+            return i;
+
+        key_type victim = s->key;
+        pthread_mutex_t *m = key_lock(victim);
+        if (m != key_lock(key) && pthread_mutex_trylock(m) != 0)
+        {
+            slot_unlock(s);
+            continue;
+        }
+        if (kv->get(t, victim) == i)
+            kv->del(t, victim);
+        if (m != key_lock(key))
+            pthread_mutex_unlock(m);
+
+        if (expired(s->expires, now))
+            thread_stats->cache_expired++;
+        else
+            thread_stats->cache_evictions++;
+        s->used = 0;
+        return i;
+    }
+}
+
+// Empty slot i if it still holds key, called with key's lock held
+static void slot_free(const struct kv_backend *kv, kv_table_t *t, key_type key, uint32_t i)
+{
+    struct cache_slot *s = &slots[i];
+    slot_lock(s);
+    if (s->used && s->key == key)
+    {
+        kv->del(t, key);
+        s->used = 0;
+        s->value = 0;
+        s->expires = 0;
+    }
+    slot_unlock(s);
+}
+
+value_type cache_get(const struct kv_backend *kv, kv_table_t *t, key_type key)
+{
+    while (1)
+    {
+        uint32_t i = kv->get(t, key);
+        if (i == 0 || i > capacity)
+            break;
+
+        struct cache_slot *s = &slots[i];
+        uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        bool match = s->used && s->key == key;
+        value_type value = s->value;
+        uint32_t expires = s->expires;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((seq & 1) || __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq)
+        {
+            thread_stats->read_retries++;
+            cpu_relax();
+            continue;
+        }
+        // The slot was taken for another key after we looked key up
+        if (!match)
+            break;
+
+        if (expired(expires, cache_clock()))
+        {
+            pthread_mutex_t *m = key_lock(key);
+            pthread_mutex_lock(m);
+            if (kv->get(t, key) == i && s->expires == expires)
+            {
+                slot_free(kv, t, key, i);
+                thread_stats->cache_expired++;
+            }
+            pthread_mutex_unlock(m);
+            break;
+        }
+
+        // Only write the shared line when the bit actually changes
+        if (!__atomic_load_n(&s->ref, __ATOMIC_RELAXED))
+            __atomic_store_n(&s->ref, 1, __ATOMIC_RELAXED);
+        thread_stats->cache_hits++;
+        return value;
+    }
+    thread_stats->cache_misses++;
+    return 0;
+}
+
+void cache_put(const struct kv_backend *kv, kv_table_t *t, key_type key, value_type value, uint32_t ttl_ms)
+{
+    if (ttl_ms == 0)
+        ttl_ms = default_ttl;
+    pthread_mutex_t *m = key_lock(key);
+    pthread_mutex_lock(m);
+
+    uint32_t i = kv->get(t, key);
+    bool fresh = i == 0 || i > capacity;
+    if (fresh)
+        i = clock_take(kv, t, key);
+    else
+        slot_lock(&slots[i]);
+
+    struct cache_slot *s = &slots[i];
+    s->key = key;
+    s->value = value;
+    s->expires = ttl_ms != 0 ? cache_clock() + ttl_ms : 0;
+    if (fresh)
+        s->ref = 0; // A key has to be read again before it survives the hand
+    s->used = 1;
+    slot_unlock(s);
+    if (fresh)
+        kv->put(t, key, i);
+    pthread_mutex_unlock(m);
+}
+
+void cache_del(const struct kv_backend *kv, kv_table_t *t, key_type key)
+{
+    pthread_mutex_t *m = key_lock(key);
+    pthread_mutex_lock(m);
+    uint32_t i = kv->get(t, key);
+    if (i != 0 && i <= capacity)
+        slot_free(kv, t, key, i);
+    pthread_mutex_unlock(m);
+}
+
+value_type cache_value(key_type key, value_type slot)
+{
+    if (slot == 0 || slot > capacity)
+        return 0;
+    struct cache_slot *s = &slots[slot];
+    while (1)
+    {
+        uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        bool match = s->used && s->key == key;
+        value_type value = s->value;
+        uint32_t expires = s->expires;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!(seq & 1) && __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+            return match && !expired(expires, cache_clock()) ? value : 0;
+        cpu_relax();
+    }
+}
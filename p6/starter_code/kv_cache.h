@@ -0,0 +1,51 @@
+#pragma once
+#include "kv_store.h"
+
+/*
+ * Capacity-bounded cache mode
+ *
+ * Keys and values live in a fixed array of capacity slots, and the table
+ * maps each key to its slot instead of holding the value. A PUT of a new key
+ * takes a slot from the CLOCK hand, evicting the first key whose reference
+ * bit is clear (or that has expired) and clearing the bits it passes. A GET
+ * takes no lock: it reads the slot under the slot's version counter, like a
+ * seqlock, and only sets the reference bit if it is clear. PUTs and DELs of
+ * a key serialize on one of a fixed set of mutexes, picked by key.
+ * Keys may carry a lifetime, checked when they are read or passed by the
+ * hand - an expired key is never returned and its slot is reused first.
+ */
+
+/*
+ * Enable cache mode - must be called before any server thread starts
+ * @param capacity maximum number of keys
+ * @param default_ttl_ms lifetime of keys PUT without one, 0 for no expiry
+ * @return 0 on success, -1 if the slots could not be allocated
+ */
+int cache_init(uint32_t capacity, uint32_t default_ttl_ms);
+
+/*
+ * Whether cache_init was called
+ */
+extern bool cache_enabled;
+
+/*
+ * GET through the slot the table maps key to, counting a hit or a miss
+ */
+value_type cache_get(const struct kv_backend *kv, kv_table_t *t, key_type key);
+
+/*
+ * PUT that takes a slot for a new key, evicting another key if all are used
+ * @param ttl_ms lifetime of the key, 0 for the default
+ */
+void cache_put(const struct kv_backend *kv, kv_table_t *t, key_type key, value_type value, uint32_t ttl_ms);
+
+/*
+ * DEL that frees the key's slot
+ */
+void cache_del(const struct kv_backend *kv, kv_table_t *t, key_type key);
+
+/*
+ * Value of key if the table maps it to slot and it has not expired, 0
+ * otherwise - for scans, which see slots rather than values
+ */
+value_type cache_value(key_type key, value_type slot);
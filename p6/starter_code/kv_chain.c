@@ -0,0 +1,167 @@
+#include "kv_store.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Grow the table once it holds more than one key per bucket on average
+#define CHAIN_MAX_LOAD 1
+// Readers revalidate this often while walking a chain, so a chain that is
+// relinked under them by a migration cannot keep them walking forever
+#define CHAIN_READ_CHECK 16
+
+// Nodes are never freed: migration relinks them into the next array, so a
+// lock-free reader holding a stale pointer still lands on a valid node
+typedef struct node
+{
+    key_type key;
+    value_type value;
+    struct node *next;
+} node_t;
+
+typedef struct
+{
+    bucket_hdr_t hdr;
+    node_t *head;
+} chain_bucket_t;
+
+// Nodes unlinked by this thread's DELs, reused by its next inserts. A reader
+// that was on a node when it was unlinked only ever fails validation
+static __thread node_t *free_nodes;
+
+static node_t *alloc_node(void)
+{
+    node_t *n = free_nodes;
+    if (n == NULL)
+        return malloc(sizeof(node_t));
+    free_nodes = n->next;
+    return n;
+}
+
+// Relink every node of b into its bucket in the next array
+static uint64_t chain_migrate(kv_table_t *t, bucket_hdr_t *hdr, table_array_t *to)
+{
+    chain_bucket_t *b = (chain_bucket_t *)hdr;
+    uint64_t moved = 0;
+    node_t *n = b->head;
+    while (n != NULL)
+    {
+        node_t *nxt = n->next;
+        chain_bucket_t *dst = (chain_bucket_t *)array_bucket(t, to, hash_function(n->key, to->size));
+        __atomic_store_n(&n->next, dst->head, __ATOMIC_RELEASE);
+        __atomic_store_n(&dst->head, n, __ATOMIC_RELEASE);
+        moved++;
+        n = nxt;
+    }
+    __atomic_store_n(&b->head, NULL, __ATOMIC_RELEASE);
+    return moved;
+}
+
+static void chain_visit(bucket_hdr_t *hdr, scan_fn fn, void *arg)
+{
+    for (node_t *n = ((chain_bucket_t *)hdr)->head; n != NULL; n = n->next)
+        fn(arg, n->key, n->value);
+}
+
+static kv_table_t *chain_create(index_t size)
+{
+    kv_table_t *t = malloc(sizeof(kv_table_t));
+    if (t == NULL)
+        return NULL;
+    if (table_init(t, size, sizeof(chain_bucket_t), CHAIN_MAX_LOAD, chain_migrate, chain_visit) < 0)
+    {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+static void chain_put(kv_table_t *t, key_type key, value_type value)
+{
+    table_migrate_step(t);
+
+    table_array_t *a;
+    chain_bucket_t *b = (chain_bucket_t *)table_lock_bucket(t, key, &a);
+    for (node_t *n = b->head; n != NULL; n = n->next)
+    {
+        if (n->key == key)
+        {
+            __atomic_store_n(&n->value, value, __ATOMIC_RELAXED);
+            table_unlock_bucket(t, &b->hdr);
+            return;
+        }
+    }
+
+    node_t *n = alloc_node();
+    if (n == NULL)
+    {
+        table_unlock_bucket(t, &b->hdr);
+        perror("malloc");
+        return;
+    }
+    n->key = key;
+    n->value = value;
+    n->next = b->head;
+    __atomic_store_n(&b->head, n, __ATOMIC_RELEASE); // Publish a fully built node
+    table_unlock_bucket(t, &b->hdr);
+
+    table_added(t, a, 1);
+}
+
+// Under SYNC_SEQLOCK this walks the chain without taking the bucket and
+// retries if the bucket version moved while we were reading
+static value_type chain_get(kv_table_t *t, key_type key)
+{
+    while (1)
+    {
+        uint32_t seq;
+        chain_bucket_t *b = (chain_bucket_t *)table_read_bucket(t, key, &seq);
+        value_type value = 0;
+        int steps = 0;
+        for (node_t *n = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE); n != NULL;
+             n = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE))
+        {
+            thread_stats->probes++;
+            if (__atomic_load_n(&n->key, __ATOMIC_RELAXED) == key)
+            {
+                value = __atomic_load_n(&n->value, __ATOMIC_RELAXED);
+                break;
+            }
+            if (++steps % CHAIN_READ_CHECK == 0 && !table_read_valid(t, &b->hdr, seq))
+                break;
+        }
+        if (table_read_done(t, &b->hdr, seq))
+        {
+            thread_stats->lookups++;
+            return value;
+        }
+    }
+}
+
+// Unlink key's node, so chains only ever hold live keys. Unlinking bumps
+// the bucket version, so a lock-free reader walking the node retries
+static void chain_del(kv_table_t *t, key_type key)
+{
+    table_array_t *a;
+    chain_bucket_t *b = (chain_bucket_t *)table_lock_bucket(t, key, &a);
+    for (node_t **link = &b->head; *link != NULL; link = &(*link)->next)
+    {
+        node_t *n = *link;
+        if (n->key != key)
+            continue;
+        __atomic_store_n(link, n->next, __ATOMIC_RELEASE);
+        table_unlock_bucket(t, &b->hdr);
+
+        n->next = free_nodes;
+        free_nodes = n;
+        table_removed(t, a, 1);
+        return;
+    }
+    table_unlock_bucket(t, &b->hdr);
+}
+
+const struct kv_backend chain_backend = {
+    .name = "chain",
+    .create = chain_create,
+    .put = chain_put,
+    .get = chain_get,
+    .del = chain_del,
+};
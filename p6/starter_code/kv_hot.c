@@ -0,0 +1,127 @@
+#include "kv_hot.h"
+#include <stdlib.h>
+
+// Shared version counters, indexed by key
+#define HOT_VERSIONS 1024
+// Replicas and sample counters each thread keeps, direct-mapped by key
+#define HOT_REPLICAS 64
+#define HOT_COUNTERS 256
+// Count one GET in this many towards promotion
+#define HOT_SAMPLE_RATE 8
+// Halve every counter after this many samples, so the counts follow the
+// recent traffic rather than the whole run
+#define HOT_WINDOW 1024
+// A key is hot once it gets this many samples in a window: about 1 GET in
+// 128 with the defaults
+#define HOT_THRESHOLD 8
+
+struct hot_version
+{
+    uint32_t v;
+} __attribute__((aligned(64)));
+
+struct hot_replica
+{
+    key_type key;
+    uint32_t version;
+    value_type value;
+    bool valid;
+};
+
+struct hot_counter
+{
+    key_type key;
+    uint32_t count;
+};
+
+bool hot_enabled = false;
+static struct hot_version *versions;
+
+// Per-thread state - every server thread samples and caches on its own
+static __thread struct hot_replica replicas[HOT_REPLICAS];
+static __thread struct hot_counter counters[HOT_COUNTERS];
+static __thread uint32_t sample_tick;
+static __thread uint32_t window_samples;
+
+int hot_init(void)
+{
+    versions = aligned_alloc(64, HOT_VERSIONS * sizeof(struct hot_version));
+    if (versions == NULL)
+        return -1;
+    for (int i = 0; i < HOT_VERSIONS; i++)
+        versions[i].v = 0;
+    hot_enabled = true;
+    return 0;
+}
+
+static inline uint32_t *version_of(key_type key)
+{
+    return &versions[hash_function(key, HOT_VERSIONS)].v;
+}
+
+// Count a sampled GET of key and report whether it is hot
+// A counter holding another key is decremented instead and taken over once
+// it reaches 0, so a slot ends up with whichever key dominates it
+static bool sample(key_type key)
+{
+    if (++sample_tick % HOT_SAMPLE_RATE != 0)
+        return false;
+
+    if (++window_samples == HOT_WINDOW)
+    {
+        window_samples = 0;
+        for (int i = 0; i < HOT_COUNTERS; i++)
+            counters[i].count /= 2;
+    }
+
+    struct hot_counter *c = &counters[hash_function(key, HOT_COUNTERS)];
+    if (c->key == key)
+        return ++c->count >= HOT_THRESHOLD;
+    if (c->count > 0)
+        c->count--;
+    else
+    {
+        c->key = key;
+        c->count = 1;
+    }
+    return false;
+}
+
+// The version is read before and after the lookup: a replica is only kept
+// if no PUT to the key completed in between, and any later PUT bumps the
+// version past it
+value_type hot_get(const struct kv_backend *kv, kv_table_t *t, key_type key)
+{
+    uint32_t *version = version_of(key);
+    uint32_t before = __atomic_load_n(version, __ATOMIC_ACQUIRE);
+    struct hot_replica *r = &replicas[hash_function(key, HOT_REPLICAS)];
+    if (r->valid && r->key == key && r->version == before)
+        return r->value;
+
+    value_type value = kv->get(t, key);
+    if ((r->valid && r->key == key) || sample(key))
+    {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(version, __ATOMIC_RELAXED) == before)
+        {
+            r->key = key;
+            r->version = before;
+            r->value = value;
+            r->valid = true;
+        }
+    }
+    return value;
+}
+
+void hot_put(const struct kv_backend *kv, kv_table_t *t, key_type key, value_type value)
+{
+    kv->put(t, key, value);
+    // Release: a reader that sees the new version also sees the new value
+    __atomic_fetch_add(version_of(key), 1, __ATOMIC_RELEASE);
+}
+
+void hot_del(const struct kv_backend *kv, kv_table_t *t, key_type key)
+{
+    kv->del(t, key);
+    __atomic_fetch_add(version_of(key), 1, __ATOMIC_RELEASE);
+}
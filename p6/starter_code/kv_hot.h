@@ -0,0 +1,39 @@
+#pragma once
+#include "kv_store.h"
+
+/*
+ * Hot-key read replicas for skewed workloads
+ *
+ * Every server thread samples the keys it reads and keeps a private copy of
+ * the value of the few keys that stand out. A copy stays valid until a PUT
+ * to a key with the same version counter bumps it, so a replica hit reads
+ * one read-mostly line instead of walking the table. Version counters are
+ * shared by all threads and indexed by key, one per cache line.
+ */
+
+/*
+ * Enable replicas - must be called before any server thread starts
+ * @return 0 on success, -1 if the version counters could not be allocated
+ */
+int hot_init(void);
+
+/*
+ * Whether hot_init was called, so callers can skip the PUT bookkeeping
+ */
+extern bool hot_enabled;
+
+/*
+ * GET through the calling thread's replicas, counting the key towards
+ * promotion on a miss
+ */
+value_type hot_get(const struct kv_backend *kv, kv_table_t *t, key_type key);
+
+/*
+ * PUT that invalidates every thread's replica of key
+ */
+void hot_put(const struct kv_backend *kv, kv_table_t *t, key_type key, value_type value);
+
+/*
+ * DEL that invalidates every thread's replica of key
+ */
+void hot_del(const struct kv_backend *kv, kv_table_t *t, key_type key);
@@ -0,0 +1,161 @@
+#include "kv_pool.h"
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define POOL_MAX_WORKERS 128
+// How often the controller samples
+#define POOL_PERIOD_NS 1000000
+// Add a worker when more than this many requests per running worker are
+// queued, or when running workers wait for less than POOL_BUSY_PCT of the time
+#define POOL_GROW_DEPTH 32
+#define POOL_BUSY_PCT 10
+// Park a worker after POOL_SHRINK_PERIODS samples in a row in which running
+// workers waited more than POOL_IDLE_PCT of the time with nothing queued
+#define POOL_IDLE_PCT 50
+#define POOL_SHRINK_PERIODS 20
+
+// One per worker, on its own line: written by the worker, read by the
+// controller. wait_start is 0 while the worker is not waiting
+struct worker_stat
+{
+    uint64_t wait_ns;
+    uint64_t wait_start;
+} __attribute__((aligned(64)));
+
+static bool pool_enabled = false;
+static uint32_t pool_target; // Futex word: workers at or above it sleep
+static int pool_min, pool_max;
+static bool pool_verbose;
+static uint32_t (*pool_depth)(void);
+static struct worker_stat stats[POOL_MAX_WORKERS];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long futex(uint32_t *addr, int op, uint32_t val)
+{
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+void pool_checkin(int worker)
+{
+    if (!pool_enabled)
+        return;
+    uint32_t target;
+    // FUTEX_WAIT returns at once if the target moved after we loaded it
+    while ((uint32_t)worker >= (target = __atomic_load_n(&pool_target, __ATOMIC_ACQUIRE)))
+    {
+        pool_wait_end(worker); // Parked time is not idle time
+        futex(&pool_target, FUTEX_WAIT, target);
+    }
+}
+
+void pool_wait_begin(int worker)
+{
+    if (pool_enabled && stats[worker].wait_start == 0)
+        __atomic_store_n(&stats[worker].wait_start, now_ns(), __ATOMIC_RELAXED);
+}
+
+void pool_wait_end(int worker)
+{
+    if (!pool_enabled || stats[worker].wait_start == 0)
+        return;
+    struct worker_stat *s = &stats[worker];
+    __atomic_store_n(&s->wait_ns, s->wait_ns + now_ns() - s->wait_start, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->wait_start, 0, __ATOMIC_RELAXED);
+}
+
+// Total time worker has waited, including a wait still in progress - a
+// worker asleep on an empty ring has to count as idle before it wakes up
+static uint64_t waited_ns(int worker, uint64_t now)
+{
+    struct worker_stat *s = &stats[worker];
+    uint64_t start = __atomic_load_n(&s->wait_start, __ATOMIC_RELAXED);
+    uint64_t total = __atomic_load_n(&s->wait_ns, __ATOMIC_RELAXED);
+    return start != 0 && now > start ? total + now - start : total;
+}
+
+static void set_target(uint32_t target)
+{
+    if (pool_verbose)
+        printf("Server: %u -> %u running workers\n", __atomic_load_n(&pool_target, __ATOMIC_RELAXED), target);
+    __atomic_store_n(&pool_target, target, __ATOMIC_RELEASE);
+    futex(&pool_target, FUTEX_WAKE, INT32_MAX);
+}
+
+static void *pool_controller(void *arg)
+{
+    (void)arg;
+    uint64_t last_wait[POOL_MAX_WORKERS] = {0};
+    uint64_t last = now_ns();
+    int idle_periods = 0;
+    struct timespec period = {0, POOL_PERIOD_NS};
+
+    while (1)
+    {
+        nanosleep(&period, NULL);
+        uint64_t now = now_ns();
+        uint32_t target = __atomic_load_n(&pool_target, __ATOMIC_RELAXED);
+
+        // Waiting time of the running workers over the period. A sample
+        // racing with the end of a wait may count it twice, so totals that
+        // go backwards are ignored until they catch up
+        uint64_t waited = 0;
+        for (int i = 0; i < pool_max; i++)
+        {
+            uint64_t w = waited_ns(i, now);
+            if (w <= last_wait[i])
+                continue;
+            if ((uint32_t)i < target)
+                waited += w - last_wait[i];
+            last_wait[i] = w;
+        }
+        uint64_t wait_pct = waited * 100 / ((now - last) * target);
+        last = now;
+        uint32_t depth = pool_depth();
+
+        if (target < (uint32_t)pool_max && (depth > POOL_GROW_DEPTH * target || (depth > 0 && wait_pct < POOL_BUSY_PCT)))
+        {
+            idle_periods = 0;
+            set_target(target + 1);
+        }
+        else if (depth == 0 && wait_pct > POOL_IDLE_PCT && target > (uint32_t)pool_min)
+        {
+            if (++idle_periods == POOL_SHRINK_PERIODS)
+            {
+                idle_periods = 0;
+                set_target(target - 1);
+            }
+        }
+        else
+            idle_periods = 0;
+    }
+    return NULL;
+}
+
+int pool_start(int min_workers, int max_workers, uint32_t (*queue_depth)(void), bool verbose)
+{
+    if (max_workers > POOL_MAX_WORKERS)
+        return -1;
+    pool_min = min_workers;
+    pool_max = max_workers;
+    pool_depth = queue_depth;
+    pool_verbose = verbose;
+    pool_target = min_workers;
+    pool_enabled = true;
+
+    pthread_t controller;
+    if (pthread_create(&controller, NULL, pool_controller, NULL) != 0)
+        return -1;
+    pthread_detach(controller);
+    return 0;
+}
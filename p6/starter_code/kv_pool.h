@@ -0,0 +1,33 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Elastic worker pool
+ *
+ * Workers [0, target) serve requests and the rest sleep on a futex. A
+ * controller thread samples the queue depth and the share of time running
+ * workers spent waiting for work, and moves target between the pool's
+ * bounds: up when requests queue, down when workers mostly wait.
+ */
+
+/*
+ * Start the controller - the server then creates max_workers workers
+ * @param queue_depth Returns how many requests are waiting to be dequeued
+ * @return 0 on success, -1 if the controller thread could not be started
+ */
+int pool_start(int min_workers, int max_workers, uint32_t (*queue_depth)(void), bool verbose);
+
+/*
+ * Call at the top of every worker iteration, holding nothing: sleeps while
+ * the worker is surplus. No-op unless pool_start was called
+ */
+void pool_checkin(int worker);
+
+/*
+ * Bracket the worker's wait for requests (dequeue or polling) so the
+ * controller can tell how idle the running workers are. Both are idempotent,
+ * so a polling worker can call them on every empty and non-empty poll
+ */
+void pool_wait_begin(int worker);
+void pool_wait_end(int worker);
@@ -0,0 +1,189 @@
+#include "kv_snapshot.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Buckets copied per pass: big enough to amortize the writes, small enough
+// that the pairs of one pass stay in cache
+#define SNAPSHOT_CHUNK 4096
+
+struct scan_buf
+{
+    struct kv_pair *pairs;
+    uint64_t n;
+    uint64_t cap;
+    snapshot_resolve_fn resolve;
+    bool failed;
+};
+
+// Runs under a bucket lock, so it only copies
+static void collect(void *arg, key_type key, value_type value)
+{
+    struct scan_buf *b = arg;
+    if (b->n == b->cap)
+    {
+        uint64_t cap = b->cap ? b->cap * 2 : 4 * SNAPSHOT_CHUNK;
+        struct kv_pair *p = realloc(b->pairs, cap * sizeof(struct kv_pair));
+        if (p == NULL)
+        {
+            b->failed = true;
+            return;
+        }
+        b->pairs = p;
+        b->cap = cap;
+    }
+    b->pairs[b->n].key = key;
+    b->pairs[b->n].value = value;
+    b->n++;
+}
+
+uint64_t snapshot_sum(const struct kv_pair *pairs, uint64_t n)
+{
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++)
+        sum += ((uint64_t)pairs[i].key * 0x9e3779b97f4a7c15ull) ^ pairs[i].value;
+    return sum;
+}
+
+// Write one table's pairs, resolved, out of the buffer's way
+static int scan_table(kv_table_t *t, struct scan_buf *b, FILE *f, uint64_t *count, uint64_t *sum)
+{
+    table_array_t *a = table_scan_start(t);
+    for (uint64_t first = 0; first < a->size; first += SNAPSHOT_CHUNK)
+    {
+        b->n = 0;
+        table_scan(t, a, first, SNAPSHOT_CHUNK, collect, b);
+        if (b->failed)
+            return -1;
+
+        uint64_t kept = 0;
+        for (uint64_t i = 0; i < b->n; i++)
+        {
+            if (b->resolve != NULL)
+                b->pairs[i].value = b->resolve(b->pairs[i].key, b->pairs[i].value);
+            // A GET can't tell a value of 0 from a missing key
+            if (b->pairs[i].value != 0)
+                b->pairs[kept++] = b->pairs[i];
+        }
+        if (fwrite(b->pairs, sizeof(struct kv_pair), kept, f) != kept)
+            return -1;
+        *count += kept;
+        *sum += snapshot_sum(b->pairs, kept);
+    }
+    return 0;
+}
+
+// Make the rename itself durable
+static void sync_dir(const char *path)
+{
+    char buf[PATH_MAX];
+    snprintf(buf, sizeof(buf), "%s", path);
+    int fd = open(dirname(buf), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return;
+    fsync(fd);
+    close(fd);
+}
+
+int64_t snapshot_write(const char *path, kv_table_t *const *tables, int n, snapshot_resolve_fn resolve)
+{
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return -1;
+    }
+
+    // The header is written again once the pairs are counted
+    struct snapshot_header h = {.magic = SNAPSHOT_MAGIC, .version = SNAPSHOT_VERSION};
+    struct scan_buf b = {.resolve = resolve};
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (int i = 0; ok && i < n; i++)
+        if (tables[i] != NULL)
+            ok = scan_table(tables[i], &b, f, &h.num_pairs, &h.checksum) == 0;
+    free(b.pairs);
+
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1 &&
+         fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0 || !ok)
+    {
+        perror("snapshot");
+        unlink(tmp_path);
+        return -1;
+    }
+    if (rename(tmp_path, path) == -1)
+    {
+        perror("rename");
+        unlink(tmp_path);
+        return -1;
+    }
+    sync_dir(path);
+    return h.num_pairs;
+}
+
+int snapshot_open(const char *path, struct snapshot *s)
+{
+    memset(s, 0, sizeof(*s));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+            return 1;
+        perror("open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(struct snapshot_header))
+    {
+        fprintf(stderr, "%s is not a snapshot\n", path);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    const struct snapshot_header *h = map;
+    if (h->magic != SNAPSHOT_MAGIC || h->version != SNAPSHOT_VERSION ||
+        (size_t)st.st_size != sizeof(*h) + h->num_pairs * sizeof(struct kv_pair))
+    {
+        fprintf(stderr, "%s is truncated or not a snapshot of this version\n", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    // Every page is about to be loaded - start reading them all now
+    madvise(map, st.st_size, MADV_WILLNEED);
+
+    s->num_pairs = h->num_pairs;
+    s->pairs = (const struct kv_pair *)(h + 1);
+    s->checksum = h->checksum;
+    s->map = map;
+    s->map_size = st.st_size;
+    return 0;
+}
+
+void snapshot_close(struct snapshot *s)
+{
+    if (s->map != NULL)
+        munmap(s->map, s->map_size);
+    s->map = NULL;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <stddef.h>
+#include "kv_store.h"
+
+/*
+ * Snapshots of the KV store
+ *
+ * A snapshot file is laid out as follows, in host byte order:
+ * | HEADER | PAIR_0 | ... | PAIR_N |
+ * so it can be mapped and loaded in place. Writers scan the tables bucket by
+ * bucket while the server keeps serving (see table_scan): each bucket is
+ * copied under its lock, so a snapshot holds every key that was present for
+ * the whole scan and, for the others, whatever the scan saw. The file is
+ * written under a temporary name and renamed into place once it is on disk,
+ * so path always holds a complete snapshot, even after a crash.
+ */
+
+#define SNAPSHOT_MAGIC 0x4e53564b /* "KVSN" in a little-endian file */
+#define SNAPSHOT_VERSION 1
+
+struct snapshot_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t num_pairs;
+	uint64_t checksum; /* snapshot_sum of every pair */
+};
+
+struct kv_pair {
+	key_type key;
+	value_type value;
+};
+
+/* A mapped snapshot */
+struct snapshot {
+	uint64_t num_pairs;
+	const struct kv_pair *pairs;
+	uint64_t checksum;
+	void *map;
+	size_t map_size;
+};
+
+/*
+ * Value a table value stands for, 0 to leave the key out - in cache mode
+ * the tables map keys to slots
+ */
+typedef value_type (*snapshot_resolve_fn)(key_type key, value_type stored);
+
+/*
+ * Write every key of tables[0..n-1] (NULL entries are skipped) to path
+ * @param resolve NULL if the tables hold the values themselves
+ * @return number of pairs written, -1 on failure
+ */
+int64_t snapshot_write(const char *path, kv_table_t *const *tables, int n, snapshot_resolve_fn resolve);
+
+/*
+ * Map the snapshot at path read-only
+ * @return 0 on success, 1 if there is no file at path, -1 if it can't be
+ * read or is not a complete snapshot
+ */
+int snapshot_open(const char *path, struct snapshot *s);
+
+void snapshot_close(struct snapshot *s);
+
+/*
+ * Checksum of n pairs - order-independent, so loaders can each sum their
+ * own slice and add the results up
+ */
+uint64_t snapshot_sum(const struct kv_pair *pairs, uint64_t n);
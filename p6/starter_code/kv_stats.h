@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * Server statistics, kept in the shared region at the offset in the
+ * stats_off field of the ring at its start, so kvstat can read them live.
+ * Each server thread owns one block and bumps its counters with plain
+ * increments. Readers see torn or slightly stale values, which is fine for
+ * rates. The table-wide fields are refreshed by a server thread that wakes
+ * every STATS_REFRESH_MS.
+ */
+
+#define STATS_MAGIC 0x4b565354 /* "KVST" */
+#define STATS_MAX_THREADS 128
+#define STATS_REFRESH_MS 100
+#define STATS_OP_TYPES 7
+
+struct __attribute__((aligned(64))) kv_thread_stats {
+	uint64_t ops[STATS_OP_TYPES]; /* Requests served, by enum REQUEST_TYPE */
+	uint64_t multi_keys;  /* Keys carried by the MGET/MPUT requests */
+	uint64_t coalesced;	  /* GETs answered from an earlier request of their burst */
+	uint64_t bursts;	  /* Dequeues that returned requests */
+	uint64_t empty_polls; /* Dequeues or passes over the rings that found nothing */
+	uint64_t lock_fails;  /* Failed attempts to take a bucket lock: spins, or a mutex found held */
+	uint64_t read_retries; /* Lock-free reads redone because a writer got in */
+	uint64_t lookups;	  /* GETs and VGETs that reached the table */
+	uint64_t probes;	  /* Chain nodes, bucket lines or arena entries those GETs examined */
+	uint64_t migrated;	  /* Buckets this thread moved during resizes */
+	uint64_t cache_hits;  /* Cache mode (server --cache): GETs that found their key */
+	uint64_t cache_misses;
+	uint64_t cache_evictions; /* Keys pushed out to make room */
+	uint64_t cache_expired;	  /* Keys dropped because their lifetime ran out */
+};
+
+struct __attribute__((aligned(64))) kv_stats {
+	uint32_t magic;
+	uint32_t nthreads;
+	uint64_t keys;			/* Keys in the table, summed over partitions */
+	uint64_t buckets;		/* Buckets of the live arrays */
+	uint64_t resize_total;	/* Buckets to migrate in resizes under way */
+	uint64_t resize_done;	/* ... and how many have moved */
+	uint64_t cache_capacity; /* Maximum keys in cache mode, 0 otherwise */
+	struct kv_thread_stats threads[STATS_MAX_THREADS];
+};
+
+/* The calling server thread's block - a process-wide scratch block until
+ * the thread calls stats_attach_thread, so it is never NULL */
+extern __thread struct kv_thread_stats *thread_stats;
+
+/* Point thread_stats at worker's block of s, or a private block if s is NULL */
+void stats_attach_thread(struct kv_stats *s, int worker);
@@ -1,54 +1,1133 @@
 #include "common.h"
 #include "ring_buffer.h"
+#include "kv_store.h"
+#include "kv_hot.h"
+#include "kv_blob.h"
+#include "kv_cache.h"
+#include "kv_snapshot.h"
+#include "affinity.h"
+#include "shm.h"
+#include "registry.h"
+#include "kv_pool.h"
+#include "latency.h"
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
 
-#define TABLE_SIZE 1000
+#define MAX_THREADS 128
+#define MAX_BURST 256
+#define COALESCE_SLOTS (2 * MAX_BURST)
+// Keys of a multi-key request whose buckets are prefetched ahead of the one
+// being resolved
+#define PREFETCH_AHEAD 8
+// Empty passes over the submission rings before a sharded server thread
+// sleeps on the doorbell
+#define SHARD_IDLE_POLLS 256
 
-typedef struct
+char shm_file[] = "shmem_file";
+char *shmem_area = NULL;
+struct ring *ring = NULL;
+struct ring *shards = NULL; /* Per-client-thread submission rings, if the client set them up */
+uint32_t num_shards = 0;
+struct ring *partitions = NULL; /* Per-partition submission rings in partitioned mode */
+uint32_t num_partitions = 0;
+const struct kv_backend *backends[] = {&chain_backend, &bucket_backend};
+const struct kv_backend *kv = &chain_backend;
+kv_table_t *ht = NULL;
+kv_table_t *partition_tables[MAX_THREADS]; // Private table of each thread in partitioned mode
+struct kv_stats *stats = NULL; // In the shared region, for kvstat
+pthread_t threads[MAX_THREADS];
+int num_threads = 1;
+int init_table_size = 1000;
+int burst_size = 32;
+const char *sync_names[] = {"seqlock", "spin", "rwlock", "striped", "global", "none"};
+enum kv_sync sync_mode = SYNC_SEQLOCK;
+int num_stripes = 1024;
+int verbose = 0;
+struct affinity affinity;
+int shm_fd = -1; // memfd inherited from the client, see --shm-fd
+int shm_flags = 0;
+int hot_replicas = 0;
+const char *listen_path = NULL; // Listen mode: the region we create for clients to attach to
+struct attach_registry *registry = NULL;
+int max_clients = 16;
+int client_rings = 8;
+int segment_mb = 4;
+int min_threads = 0; // Elastic pool: keep between min_threads and num_threads workers running
+int arena_mb = 0;     // Listen mode: MiB of arena for VPUT values
+uint32_t cache_keys = 0; // Cache mode: evict beyond this many keys
+uint32_t default_ttl_ms = 0;
+const char *snapshot_path = NULL; // Restore from this file on startup, write it on SIGTERM
+int snapshot_ms = 0;              // ... and every snapshot_ms if positive
+struct snapshot restore;          // The snapshot being restored, if any
+uint64_t restore_sums[MAX_THREADS];
+// Partitioned restore: keys of partition q in loader l's slice, and the
+// snapshot's pairs grouped by partition
+uint64_t restore_counts[MAX_THREADS][MAX_THREADS];
+struct kv_pair *restore_grouped;
+pthread_barrier_t restore_barrier;
+// Set before the final snapshot: server threads park instead of serving
+// their next burst, and clear busy while they are not serving one
+bool stopping = false;
+struct __attribute__((aligned(64))) worker_busy
+{
+    int busy;
+} workers_busy[MAX_THREADS];
+
+// Prints "Server" before each line of output because the client prints to
+// the same terminal
+#define PRINTV(...)         \
+    if (verbose)            \
+        printf("Server: "); \
+    if (verbose)            \
+    printf(__VA_ARGS__)
+
+// Write the result of a request to its window in the Request-status Board
+// The ready flag is set last, with release semantics, so the client never
+// sees a ready window with a stale result. If the client asked for
+// notifications, wake the submitting thread in case it is asleep
+// A client that reaps out of order gets the descriptor itself, tag and all,
+// in its completion ring instead. It keeps at most RING_SIZE requests in
+// flight, so the ring always has room
+void complete_request(struct buffer_descriptor *bd)
+{
+    if (bd->t_submit != 0)
+        bd->t_complete = now_ns();
+    if (bd->cq_off != 0)
+    {
+        ring_submit_burst((struct ring *)(shmem_area + bd->cq_off), bd, 1);
+        return;
+    }
+    struct buffer_descriptor *result = (struct buffer_descriptor *)(shmem_area + bd->res_off);
+    memcpy(result, bd, sizeof(struct buffer_descriptor));
+    __atomic_store_n(&result->ready, 1, __ATOMIC_RELEASE);
+    if (bd->notify_off != 0)
+        completion_notify((struct completion_bell *)(shmem_area + bd->notify_off));
+}
+
+static value_type kv_get(kv_table_t *t, key_type key)
+{
+    if (cache_enabled)
+        return cache_get(kv, t, key);
+    return hot_enabled ? hot_get(kv, t, key) : kv->get(t, key);
+}
+
+// ttl_ms only matters in cache mode
+static void kv_put(kv_table_t *t, key_type key, value_type value, uint32_t ttl_ms)
+{
+    if (cache_enabled)
+        cache_put(kv, t, key, value, ttl_ms);
+    else if (hot_enabled)
+        hot_put(kv, t, key, value);
+    else
+        kv->put(t, key, value);
+}
+
+static void kv_del(kv_table_t *t, key_type key)
+{
+    if (cache_enabled)
+        cache_del(kv, t, key);
+    else if (hot_enabled)
+        hot_del(kv, t, key);
+    else
+        kv->del(t, key);
+}
+
+// Serve an MGET/MPUT from its payload in shared memory
+// Each bucket is prefetched PREFETCH_AHEAD keys before it is needed, so the
+// cache misses of the batch overlap instead of being taken one at a time
+static void serve_multi(kv_table_t *t, struct buffer_descriptor *bd)
+{
+    struct multi_payload *p = (struct multi_payload *)(shmem_area + bd->payload_off);
+    uint32_t n = p->n < MAX_MULTI_KEYS ? p->n : MAX_MULTI_KEYS;
+    thread_stats->multi_keys += n;
+    for (uint32_t i = 0; i < n && i < PREFETCH_AHEAD; i++)
+        table_prefetch(t, p->keys[i]);
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (i + PREFETCH_AHEAD < n)
+            table_prefetch(t, p->keys[i + PREFETCH_AHEAD]);
+        if (bd->req_type == MPUT)
+            kv_put(t, p->keys[i], p->values[i], 0);
+        else
+            p->values[i] = kv_get(t, p->keys[i]);
+    }
+}
+
+// Serve a VPUT/VGET from its blob_payload in shared memory
+// A VGET only tells the client where the value is, the client reads it in
+// place. Without an arena every VPUT is dropped and every VGET misses
+static void serve_blob(struct buffer_descriptor *bd)
+{
+    struct blob_payload *p = (struct blob_payload *)(shmem_area + bd->payload_off);
+    uint32_t key_len = p->key_len < BLOB_MAX_KEY ? p->key_len : BLOB_MAX_KEY;
+    if (bd->req_type == VPUT)
+    {
+        uint32_t val_len = p->val_len < BLOB_MAX_VALUE ? p->val_len : BLOB_MAX_VALUE;
+        bd->v = blob_enabled ? blob_put(bd->k, p->data, key_len, p->data + key_len, val_len) : 0;
+        return;
+    }
+
+    uint32_t version = 0, val_len = 0;
+    bd->v = blob_enabled ? blob_get(bd->k, p->data, key_len, &version, &val_len) : 0;
+    p->val_len = val_len;
+    p->reply_version = version;
+    p->reply_off = bd->v;
+}
+
+// Values seen so far in the batch being served, by key, so duplicate GETs
+// in one burst cost one lookup. Slots from older batches count as empty
+struct coalesce_slot
 {
     key_type key;
     value_type value;
-    pthread_mutex_t lock; // Per-entry lock for fine-grained synchronization
-} entry_t;
+    uint32_t batch;
+};
+static __thread struct coalesce_slot coalesce[COALESCE_SLOTS];
+static __thread uint32_t batch_id;
+
+// Forget every value recorded so far
+static void coalesce_reset(void)
+{
+    if (++batch_id == 0)
+    {
+        memset(coalesce, 0, sizeof(coalesce));
+        batch_id = 1;
+    }
+}
+
+// Find key's slot for this batch, or the empty slot to record it in
+// Linear probing never runs out: a batch uses at most half of the slots
+static struct coalesce_slot *coalesce_find(key_type key, uint32_t batch)
+{
+    index_t i = hash_function(key, COALESCE_SLOTS);
+    while (coalesce[i].batch == batch && coalesce[i].key != key)
+        i = (i + 1) % COALESCE_SLOTS;
+    return &coalesce[i];
+}
 
-typedef struct
+// Serve a batch of requests fetched from a ring against table t
+// Every request of a batch was in the ring at the same time, so a GET may
+// return what an earlier request of the batch read or wrote for its key
+void serve_requests(kv_table_t *t, struct buffer_descriptor *bds, unsigned n)
 {
-    entry_t entries[TABLE_SIZE];
-} hashtable_t;
+    coalesce_reset();
+
+    thread_stats->bursts++;
+    // One timestamp for the whole burst, taken only if a request is traced
+    uint64_t dequeued = 0;
+    for (unsigned i = 0; i < n; i++)
+    {
+        if (bds[i].t_submit == 0)
+            continue;
+        if (dequeued == 0)
+            dequeued = now_ns();
+        bds[i].t_dequeue = dequeued;
+    }
+
+    for (unsigned i = 0; i < n; i++)
+    {
+        struct buffer_descriptor *bd = &bds[i];
+        if ((unsigned)bd->req_type < STATS_OP_TYPES)
+            thread_stats->ops[bd->req_type]++;
+        if (bd->req_type == MGET || bd->req_type == MPUT)
+        {
+            serve_multi(t, bd);
+            // Up to MAX_MULTI_KEYS keys changed: rather than recording them
+            // all, start over so later GETs of the burst read the table
+            if (bd->req_type == MPUT)
+                coalesce_reset();
+            complete_request(bd);
+            continue;
+        }
+        if (bd->req_type == VPUT || bd->req_type == VGET)
+        {
+            serve_blob(bd);
+            complete_request(bd);
+            continue;
+        }
+
+        struct coalesce_slot *s = n > 1 ? coalesce_find(bd->k, batch_id) : NULL;
+        if (bd->req_type == PUT)
+            kv_put(t, bd->k, bd->v, bd->ttl_ms);
+        else if (bd->req_type == DEL)
+        {
+            // GETs later in the batch see the key as absent
+            kv_del(t, bd->k);
+            bd->v = 0;
+        }
+        else if (s != NULL && s->batch == batch_id)
+        {
+            bd->v = s->value;
+            thread_stats->coalesced++;
+        }
+        else
+            bd->v = kv_get(t, bd->k);
 
-void put(hashtable_t *ht, key_type key, value_type value)
+        if (s != NULL)
+        {
+            s->key = bd->k;
+            s->value = bd->v;
+            s->batch = batch_id;
+        }
+        complete_request(bd);
+    }
+}
+
+// Block until the ring has requests, counting the dequeues that find it empty
+static unsigned dequeue_burst(struct ring *r, struct buffer_descriptor *bds)
 {
-    index_t index = hash_function(key, TABLE_SIZE); // Compute the hash index
-    pthread_mutex_lock(&ht->entries[index].lock);   // Lock the entry
-    ht->entries[index].key = key;
-    ht->entries[index].value = value;
-    pthread_mutex_unlock(&ht->entries[index].lock); // Unlock the entry
+    unsigned n = ring_try_get_burst(r, bds, burst_size);
+    if (n > 0)
+        return n;
+    thread_stats->empty_polls++;
+    return ring_get_burst(r, bds, burst_size);
 }
 
-value_type get(hashtable_t *ht, key_type key)
+// Serve a burst, or park for good once the server is stopping for its final
+// snapshot - the snapshot thread exits the process when it is written
+// busy is set before stopping is checked, and the snapshot thread does the
+// opposite, so one of them always sees the other's store
+static void serve_burst(int tid, kv_table_t *t, struct buffer_descriptor *bds, unsigned n)
 {
-    index_t index = hash_function(key, TABLE_SIZE); // Compute the hash index
-    pthread_mutex_lock(&ht->entries[index].lock);   // Lock the entry
-    value_type value = ht->entries[index].key == key ? ht->entries[index].value : 0;
-    pthread_mutex_unlock(&ht->entries[index].lock); // Unlock the entry
-    return value;
+    if (snapshot_path == NULL)
+    {
+        serve_requests(t, bds, n);
+        return;
+    }
+    __atomic_store_n(&workers_busy[tid].busy, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&stopping, __ATOMIC_SEQ_CST))
+    {
+        __atomic_store_n(&workers_busy[tid].busy, 0, __ATOMIC_RELEASE);
+        while (1)
+            pause();
+    }
+    serve_requests(t, bds, n);
+    __atomic_store_n(&workers_busy[tid].busy, 0, __ATOMIC_RELEASE);
 }
 
 // Server thread function
+// Fetch up to burst_size requests from the Ring Buffer per wakeup, serve them
+// from the KV Store and post the results to the Request-status Board - runs
+// until the client kills us
 void *server_thread(void *arg)
 {
-    // TODO: Implement the server thread logic
-    // - Fetch requests from the Ring Buffer
-    // - Process requests and update the Request-status Board
-    // - Use the KV Store (hashtable) to handle PUT and GET requests
-    // - Ensure proper synchronization when accessing shared data structures
+    int tid = (int)(long)arg;
+    affinity_pin(&affinity, tid);
+    stats_attach_thread(stats, tid);
+    struct buffer_descriptor bds[MAX_BURST];
+    while (1)
+    {
+        pool_checkin(tid);
+        pool_wait_begin(tid);
+        unsigned n = dequeue_burst(ring, bds);
+        pool_wait_end(tid);
+        serve_burst(tid, ht, bds, n);
+    }
+    return NULL;
+}
+
+// Poll the submission rings: first the ones this thread owns (shard i is
+// owned by thread i % num_threads), then every other ring to steal work
+unsigned poll_shards(int tid, struct buffer_descriptor *bds)
+{
+    unsigned n;
+    for (uint32_t i = tid; i < num_shards; i += num_threads)
+        if ((n = ring_try_get_burst(&shards[i], bds, burst_size)) > 0)
+            return n;
+    for (uint32_t j = 1; j <= num_shards; j++)
+    {
+        uint32_t i = (tid + j) % num_shards;
+        if ((int)(i % num_threads) != tid && (n = ring_try_get_burst(&shards[i], bds, burst_size)) > 0)
+            return n;
+    }
+    return 0;
+}
+
+// Listen mode: poll the rings of every attached client, each thread starting
+// from a different client so they spread over the clients when all are busy
+// Rings are only peeked at until one has requests: the slot is then entered
+// before taking them, and *held is set so the caller leaves it once they
+// are completed
+unsigned poll_clients(int tid, struct buffer_descriptor *bds, int *held)
+{
+    unsigned n;
+    for (uint32_t j = 0; j < registry->max_clients; j++)
+    {
+        uint32_t c = (tid + j) % registry->max_clients;
+        struct attach_slot *s = &registry->slots[c];
+        if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != ATTACH_ACTIVE)
+            continue;
+        struct ring *rings = registry_rings(registry, c);
+        for (uint32_t i = 0; i < s->nrings; i++)
+        {
+            if (ring_count(&rings[i]) == 0 || !registry_enter(registry, c))
+                continue;
+            if ((n = ring_try_get_burst(&rings[i], bds, burst_size)) > 0)
+            {
+                *held = c;
+                return n;
+            }
+            registry_leave(registry, c);
+        }
+    }
+    return 0;
+}
+
+// Requests waiting in whichever rings the server threads consume from,
+// sampled by the elastic pool's controller
+uint32_t queue_depth(void)
+{
+    uint32_t depth = 0;
+    if (registry != NULL)
+    {
+        for (uint32_t c = 0; c < registry->max_clients; c++)
+        {
+            struct attach_slot *s = &registry->slots[c];
+            if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != ATTACH_ACTIVE)
+                continue;
+            for (uint32_t i = 0; i < s->nrings; i++)
+                depth += ring_count(&registry_rings(registry, c)[i]);
+        }
+    }
+    else if (num_shards > 0)
+    {
+        for (uint32_t i = 0; i < num_shards; i++)
+            depth += ring_count(&shards[i]);
+    }
+    else
+        depth = ring_count(ring);
+    return depth;
+}
+
+// Server thread function for sharded submission rings, and for the rings of
+// attached clients in listen mode
+// When every ring stays empty for a while, sleep on the doorbell in the
+// main ring, which client threads ring after each submission
+void *server_thread_sharded(void *arg)
+{
+    int tid = (int)(long)arg;
+    affinity_pin(&affinity, tid);
+    stats_attach_thread(stats, tid);
+    struct buffer_descriptor bds[MAX_BURST];
+    unsigned idle = 0;
+    while (1)
+    {
+        pool_checkin(tid);
+        int held = -1; // Client slot the burst came from in listen mode
+        unsigned n = registry != NULL ? poll_clients(tid, bds, &held) : poll_shards(tid, bds);
+        if (n > 0)
+        {
+            idle = 0;
+            pool_wait_end(tid);
+            serve_burst(tid, ht, bds, n);
+            if (held >= 0)
+                registry_leave(registry, held);
+            continue;
+        }
+        pool_wait_begin(tid);
+        thread_stats->empty_polls++;
+        if (++idle < SHARD_IDLE_POLLS)
+        {
+            cpu_relax();
+            continue;
+        }
+
+        idle = 0;
+        uint32_t token = ring_bell_arm(ring);
+        if ((n = registry != NULL ? poll_clients(tid, bds, &held) : poll_shards(tid, bds)) > 0)
+        {
+            ring_bell_cancel(ring);
+            pool_wait_end(tid);
+            serve_burst(tid, ht, bds, n);
+            if (held >= 0)
+                registry_leave(registry, held);
+        }
+        else
+            ring_bell_wait(ring, token);
+    }
+    return NULL;
+}
+
+// Buckets for a table that holds 1/parts of the keys: enough for the
+// snapshot being restored, so loading it does not go through resizes
+static int table_size(int parts)
+{
+    uint64_t keys = restore.num_pairs > (uint64_t)init_table_size ? restore.num_pairs : (uint64_t)init_table_size;
+    keys /= parts;
+    if (keys > INT32_MAX)
+        keys = INT32_MAX;
+    return keys > 0 ? keys : 1;
+}
+
+static kv_table_t *create_partition(int tid)
+{
+    kv_table_t *t = kv->create(table_size(num_threads));
+    if (t == NULL || table_set_sync(t, SYNC_NONE, 0) < 0)
+    {
+        perror("create");
+        exit(EXIT_FAILURE);
+    }
+    __atomic_store_n(&partition_tables[tid], t, __ATOMIC_RELEASE);
+    return t;
+}
+
+// Number of threads restoring a snapshot: every server thread, unless the
+// one table has no locks
+static int num_loaders(void)
+{
+    return num_partitions == 0 && sync_mode == SYNC_NONE ? 1 : num_threads;
+}
+
+// Partitioned restore, loader tid: group the pairs of [first, last) by
+// partition into restore_grouped, then load partition tid's group into the
+// table server thread tid will own. Partition q's group holds the keys of q
+// from loader 0's slice, then from loader 1's, and so on
+static void load_partition(int tid, const struct kv_pair *p, uint64_t first, uint64_t last)
+{
+    uint64_t *counts = restore_counts[tid];
+    for (uint64_t i = first; i < last; i++)
+        counts[partition_of(p[i].key, num_partitions)]++;
+    pthread_barrier_wait(&restore_barrier);
+
+    uint64_t next[MAX_THREADS];
+    uint64_t group = 0, group_end = 0, off = 0;
+    for (uint32_t q = 0; q < num_partitions; q++)
+    {
+        if (q == (uint32_t)tid)
+            group = off;
+        for (int l = 0; l < num_loaders(); l++)
+        {
+            if (l == tid)
+                next[q] = off;
+            off += restore_counts[l][q];
+        }
+        if (q == (uint32_t)tid)
+            group_end = off;
+    }
+    for (uint64_t i = first; i < last; i++)
+        restore_grouped[next[partition_of(p[i].key, num_partitions)]++] = p[i];
+    pthread_barrier_wait(&restore_barrier);
+
+    kv_table_t *t = create_partition(tid);
+    for (uint64_t i = group; i < group_end; i++)
+        kv_put(t, restore_grouped[i].key, restore_grouped[i].value, 0);
+}
+
+// Loader i reads the i-th slice of the snapshot, pinned where server thread
+// i runs, and puts it into the table. In partitioned mode it instead creates
+// partition i's table, as server thread i would, and loads the keys of that
+// partition from every slice. Each loader sums its slice, so the checksum is
+// verified in parallel
+void *load_thread(void *arg)
+{
+    int tid = (int)(long)arg;
+    affinity_pin(&affinity, tid);
+    stats_attach_thread(stats, tid);
+
+    const struct kv_pair *p = restore.pairs;
+    uint64_t first = restore.num_pairs * tid / num_loaders();
+    uint64_t last = restore.num_pairs * (tid + 1) / num_loaders();
+    if (num_partitions > 0)
+        load_partition(tid, p, first, last);
+    else
+        for (uint64_t i = first; i < last; i++)
+            kv_put(ht, p[i].key, p[i].value, 0);
+    restore_sums[tid] = snapshot_sum(p + first, last - first);
+    return NULL;
+}
+
+// Load the snapshot mapped at restore before any server thread starts -
+// requests that arrive meanwhile wait in their rings
+static int restore_snapshot(void)
+{
+    uint64_t start = now_ns();
+    if (num_partitions > 0)
+    {
+        restore_grouped = malloc(restore.num_pairs * sizeof(struct kv_pair));
+        if (restore_grouped == NULL && restore.num_pairs > 0)
+        {
+            perror("malloc");
+            return -1;
+        }
+        pthread_barrier_init(&restore_barrier, NULL, num_loaders());
+    }
+    pthread_t tids[MAX_THREADS];
+    for (long i = 0; i < num_loaders(); i++)
+        if (pthread_create(&tids[i], NULL, load_thread, (void *)i))
+        {
+            perror("pthread_create");
+            return -1; // Loaders already started may be stuck at the barrier, but we exit
+        }
+    uint64_t sum = 0;
+    for (int i = 0; i < num_loaders(); i++)
+    {
+        if (pthread_join(tids[i], NULL))
+            perror("pthread_join");
+        sum += restore_sums[i];
+    }
+    free(restore_grouped);
+    restore_grouped = NULL;
+    if (sum != restore.checksum)
+    {
+        fprintf(stderr, "%s is corrupt: its checksum does not match its keys\n", snapshot_path);
+        return -1;
+    }
+    PRINTV("Restored %lu keys from %s with %d threads in %.1f ms\n", (unsigned long)restore.num_pairs,
+           snapshot_path, num_loaders(), (now_ns() - start) / 1e6);
+    snapshot_close(&restore);
+    return 0;
+}
+
+// Write every table to snapshot_path - periodic snapshots run while the
+// server threads keep serving, the final one once they are stopped
+static void take_snapshot(void)
+{
+    kv_table_t *tables[MAX_THREADS + 1];
+    int n = 0;
+    if (ht != NULL)
+        tables[n++] = ht;
+    for (uint32_t i = 0; i < num_partitions; i++)
+        tables[n++] = __atomic_load_n(&partition_tables[i], __ATOMIC_ACQUIRE);
+
+    uint64_t start = now_ns();
+    int64_t pairs = snapshot_write(snapshot_path, tables, n, cache_enabled ? cache_value : NULL);
+    if (pairs < 0)
+        return;
+    PRINTV("Wrote %ld keys to %s in %.1f ms\n", (long)pairs, snapshot_path, (now_ns() - start) / 1e6);
+}
+
+// Park every server thread between two bursts, so nothing uses the tables
+// any more - even those without locks can then be scanned. Requests left in
+// the rings are never served
+static void stop_workers(void)
+{
+    __atomic_store_n(&stopping, true, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < num_threads; i++)
+        while (__atomic_load_n(&workers_busy[i].busy, __ATOMIC_SEQ_CST))
+            sched_yield();
+}
+
+// Write a snapshot every snapshot_ms, and a last one on SIGTERM or SIGINT,
+// after stopping the server threads, then exit. Every other thread has both
+// signals blocked, so they are only ever taken here, between two snapshots
+void *snapshot_thread(void *arg)
+{
+    sigset_t *set = arg;
+    struct timespec period = {snapshot_ms / 1000, (snapshot_ms % 1000) * 1000000L};
+    while (1)
+    {
+        int sig = snapshot_ms > 0 ? sigtimedwait(set, NULL, &period) : sigwaitinfo(set, NULL);
+        if (sig < 0 && errno == EINTR)
+            continue;
+        if (sig > 0)
+            stop_workers();
+        take_snapshot();
+        if (sig > 0)
+        {
+            fflush(stdout);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+    return NULL;
+}
+
+// Server thread function for partitioned mode
+// Thread i alone owns partition i: the client routes every key of the
+// partition to ring i, and the table is created here, after pinning, so it
+// is private to this thread, needs no locks and is first touched on its node
+// (unless loader i, pinned to the same CPU, already created it)
+void *server_thread_partitioned(void *arg)
+{
+    int tid = (int)(long)arg;
+    affinity_pin(&affinity, tid);
+    stats_attach_thread(stats, tid);
+
+    kv_table_t *t = partition_tables[tid];
+    if (t == NULL)
+        t = create_partition(tid);
+
+    struct buffer_descriptor bds[MAX_BURST];
+    while (1)
+    {
+        unsigned n = dequeue_burst(&partitions[tid], bds);
+        serve_burst(tid, t, bds, n);
+    }
+    return NULL;
+}
+
+// Refresh the table-wide statistics every STATS_REFRESH_MS
+void *stats_thread(void *arg)
+{
+    (void)arg;
+    static struct kv_stats totals;
+    struct timespec period = {0, STATS_REFRESH_MS * 1000000L};
+    while (1)
+    {
+        totals.keys = totals.buckets = totals.resize_total = totals.resize_done = 0;
+        if (ht != NULL)
+            table_stats(ht, &totals);
+        for (uint32_t i = 0; i < num_partitions; i++)
+        {
+            kv_table_t *t = __atomic_load_n(&partition_tables[i], __ATOMIC_ACQUIRE);
+            if (t != NULL)
+                table_stats(t, &totals);
+        }
+        stats->keys = totals.keys;
+        stats->buckets = totals.buckets;
+        stats->resize_total = totals.resize_total;
+        stats->resize_done = totals.resize_done;
+        nanosleep(&period, NULL);
+    }
+    return NULL;
+}
+
+// Map the shared region the client created, from shm_file or the
+// inherited memfd. The ring lives at the start of the region and is
+// already initialized
+int init_server()
+{
+    struct shm_region shm;
+    if (listen_path != NULL)
+    {
+        size_t size = registry_region_size(max_clients, client_rings, (uint64_t)segment_mb << 20);
+        size_t stats_off = (size + 63) & ~(size_t)63;
+        size_t arena_off = (stats_off + sizeof(struct kv_stats) + 63) & ~(size_t)63;
+        if (size > 0)
+            size = arena_off + ((size_t)arena_mb << 20);
+        if (size == 0 || size > INT32_MAX)
+        {
+            fprintf(stderr, "The region for %d clients and the arena would be over 2 GiB\n", max_clients);
+            return -1;
+        }
+        // Built under a temporary name, so clients never map a half-built region
+        char tmp_path[PATH_MAX];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", listen_path);
+        if (shm_create(&shm, tmp_path, size, shm_flags) < 0)
+            return -1;
+        shmem_area = shm.mem;
+        ring = (struct ring *)shm.mem;
+        registry = registry_init(shm.mem, max_clients, client_rings, (uint64_t)segment_mb << 20);
+        ring->stats_off = stats_off;
+        stats = (struct kv_stats *)(shm.mem + stats_off);
+        if (arena_mb > 0)
+        {
+            ring->arena_off = arena_off;
+            ring->arena_size = (uint32_t)arena_mb << 20;
+        }
+        if (rename(tmp_path, listen_path) == -1)
+        {
+            perror("rename");
+            return -1;
+        }
+        PRINTV("Listening on %s: %d clients of up to %d threads, %d MiB each\n",
+               listen_path, max_clients, client_rings, segment_mb);
+        return 0;
+    }
+
+    if (shm_attach(&shm, shm_file, shm_fd, shm_flags) < 0)
+        return -1;
+
+    char *mem = shm.mem;
+    shmem_area = mem;
+    ring = (struct ring *)mem;
+    num_shards = ring->num_shards;
+    if (num_shards > 0)
+        shards = ring + 1;
+    num_partitions = ring->num_partitions;
+    if (num_partitions > 0)
+        partitions = ring + 1;
+    if (ring->stats_off != 0)
+        stats = (struct kv_stats *)(mem + ring->stats_off);
+    PRINTV("Mapped %zu bytes of shared memory, %u submission rings, %u partitions\n",
+           shm.size, num_shards, num_partitions);
+    return 0;
+}
+
+void usage(char *name)
+{
+    printf("Usage: %s [-h] [-n num_threads] [-s init_table_size] [-b burst_size] [-k backend] [-l sync] [-c stripes] [--cpus list] [--affinity mode] [--shm-fd fd] [--huge] [--hot] [--cache max_keys [--ttl ms]] [--listen file [--max-clients n] [--client-rings n] [--segment-mb n] [--arena-mb n]] [--min-threads n] [--snapshot file [--snapshot-ms ms]] [-v]\n", name);
+    printf("-h show this help\n");
+    printf("-n specify the number of server threads\n");
+    printf("-s specify the initial hashtable size\n");
+    printf("-b max number of requests dequeued from the ring per wakeup (default: 32, max: %d)\n", MAX_BURST);
+    printf("-k KV store backend: chain (linked chains, default) or bucket (64-byte SIMD-probed buckets)\n");
+    printf("-l KV store synchronization: seqlock (default), spin, rwlock, striped, global or none (only safe with -n 1)\n");
+    printf("-c number of locks for -l striped (default: 1024)\n");
+    printf("--cpus pin server thread i to the i-th CPU of a list such as 0-3,8 (wraps around)\n");
+    printf("--affinity none (default) or auto - pin server threads to alternate cores of each LLC, next to the client's threads\n");
+    printf("--shm-fd map this inherited memfd instead of %s (passed by the client with --memfd)\n", shm_file);
+    printf("--huge request transparent huge pages for the shared region\n");
+    printf("--hot serve GETs of frequently read keys from per-thread replicas, invalidated by PUTs\n");
+    printf("--cache run as a cache of at most this many keys, evicting with CLOCK beyond that (not in partitioned mode)\n");
+    printf("--ttl with --cache, keys PUT without a lifetime of their own expire after this many ms (default: never)\n");
+    printf("--listen create file for client processes to attach to (client --attach), and keep serving them until killed\n");
+    printf("--max-clients client processes attached at once with --listen (default: 16, max: %d)\n", MAX_ATTACH_CLIENTS);
+    printf("--client-rings threads per client process with --listen (default: 8)\n");
+    printf("--segment-mb MiB of board space per client process with --listen (default: 4)\n");
+    printf("--arena-mb MiB of shared memory for the values of vput requests with --listen (default: 0, no vput/vget); a client that creates the region sizes the arena itself\n");
+    printf("--min-threads keep between this many and -n server threads running, parking the rest while the load is low\n");
+    printf("--snapshot restore the keys in file on startup if it exists, and write them to it when killed with SIGTERM or SIGINT\n");
+    printf("--snapshot-ms with --snapshot, also write the file this often while serving (not with -l none or in partitioned mode)\n");
+    printf("-v give verbose output if set\n");
+}
+
+static int parse_args(int argc, char **argv)
+{
+    static struct option long_opts[] = {
+        {"cpus", required_argument, NULL, 'C'},
+        {"affinity", required_argument, NULL, 'A'},
+        {"shm-fd", required_argument, NULL, 'F'},
+        {"huge", no_argument, NULL, 'H'},
+        {"hot", no_argument, NULL, 'R'},
+        {"cache", required_argument, NULL, 'K'},
+        {"ttl", required_argument, NULL, 'X'},
+        {"listen", required_argument, NULL, 'L'},
+        {"max-clients", required_argument, NULL, 'M'},
+        {"client-rings", required_argument, NULL, 'T'},
+        {"segment-mb", required_argument, NULL, 'G'},
+        {"arena-mb", required_argument, NULL, 'V'},
+        {"min-threads", required_argument, NULL, 'm'},
+        {"snapshot", required_argument, NULL, 'S'},
+        {"snapshot-ms", required_argument, NULL, 'P'},
+        {NULL, 0, NULL, 0}};
+    const char *cpu_list = NULL;
+    const char *affinity_mode = NULL;
+
+    int op;
+    while ((op = getopt_long(argc, argv, "hn:s:b:k:l:c:v", long_opts, NULL)) != -1)
+    {
+        switch (op)
+        {
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+            break;
+
+        case 'n':
+            num_threads = atoi(optarg);
+            break;
+
+        case 's':
+            init_table_size = atoi(optarg);
+            break;
+
+        case 'b':
+            burst_size = atoi(optarg);
+            break;
+
+        case 'k':
+            kv = NULL;
+            for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+                if (!strcmp(optarg, backends[i]->name))
+                    kv = backends[i];
+            if (kv == NULL)
+            {
+                fprintf(stderr, "Unknown backend %s\n", optarg);
+                return 1;
+            }
+            break;
+
+        case 'l':
+        {
+            int found = -1;
+            for (size_t i = 0; i < sizeof(sync_names) / sizeof(sync_names[0]); i++)
+                if (!strcmp(optarg, sync_names[i]))
+                    found = i;
+            if (found < 0)
+            {
+                fprintf(stderr, "Unknown synchronization %s\n", optarg);
+                return 1;
+            }
+            sync_mode = found;
+            break;
+        }
+
+        case 'c':
+            num_stripes = atoi(optarg);
+            break;
+
+        case 'C':
+            cpu_list = optarg;
+            break;
+
+        case 'A':
+            affinity_mode = optarg;
+            break;
+
+        case 'F':
+            shm_fd = atoi(optarg);
+            break;
+
+        case 'H':
+            shm_flags |= SHM_HUGE;
+            break;
+
+        case 'R':
+            hot_replicas = 1;
+            break;
+
+        case 'K':
+            cache_keys = strtoul(optarg, NULL, 10);
+            if (cache_keys == 0 || cache_keys >= UINT32_MAX)
+            {
+                fprintf(stderr, "--cache must be between 1 and %u\n", UINT32_MAX - 1);
+                return 1;
+            }
+            break;
+
+        case 'X':
+            default_ttl_ms = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'L':
+            listen_path = optarg;
+            break;
+
+        case 'M':
+            max_clients = atoi(optarg);
+            break;
+
+        case 'T':
+            client_rings = atoi(optarg);
+            break;
+
+        case 'G':
+            segment_mb = atoi(optarg);
+            break;
+
+        case 'V':
+            arena_mb = atoi(optarg);
+            break;
+
+        case 'm':
+            min_threads = atoi(optarg);
+            if (min_threads < 1)
+            {
+                fprintf(stderr, "--min-threads must be positive\n");
+                return 1;
+            }
+            break;
+
+        case 'S':
+            snapshot_path = optarg;
+            break;
+
+        case 'P':
+            snapshot_ms = atoi(optarg);
+            if (snapshot_ms < 1)
+            {
+                fprintf(stderr, "--snapshot-ms must be positive\n");
+                return 1;
+            }
+            break;
+
+        case 'v':
+            verbose = 1;
+            break;
+
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (num_threads < 1 || num_threads > MAX_THREADS)
+    {
+        fprintf(stderr, "Number of threads must be between 1 and %d\n", MAX_THREADS);
+        return 1;
+    }
+    if (init_table_size < 1)
+    {
+        fprintf(stderr, "Initial table size must be positive\n");
+        return 1;
+    }
+    if (affinity_init(&affinity, cpu_list, affinity_mode, AFFINITY_SERVER) < 0)
+        return 1;
+    if (min_threads > num_threads)
+    {
+        fprintf(stderr, "--min-threads can't be above -n\n");
+        return 1;
+    }
+    if (arena_mb < 0 || arena_mb > 2047)
+    {
+        fprintf(stderr, "--arena-mb must be between 0 and 2047\n");
+        return 1;
+    }
+    if (max_clients < 1 || max_clients > MAX_ATTACH_CLIENTS || client_rings < 1 || segment_mb < 1)
+    {
+        fprintf(stderr, "--listen needs 1 to %d clients and at least one ring and one MiB each\n", MAX_ATTACH_CLIENTS);
+        return 1;
+    }
+    if (listen_path != NULL && shm_fd >= 0)
+    {
+        fprintf(stderr, "--listen and --shm-fd can't be combined\n");
+        return 1;
+    }
+    if (num_stripes < 1)
+    {
+        fprintf(stderr, "Number of stripes must be positive\n");
+        return 1;
+    }
+    if (burst_size < 1 || burst_size > MAX_BURST)
+    {
+        fprintf(stderr, "Burst size must be between 1 and %d\n", MAX_BURST);
+        return 1;
+    }
+    if (snapshot_ms > 0 && (snapshot_path == NULL || sync_mode == SYNC_NONE))
+    {
+        fprintf(stderr, "--snapshot-ms needs --snapshot and a table with locks\n");
+        return 1;
+    }
+    return 0;
 }
 
 int main(int argc, char *argv[])
 {
-    // TODO: Parse command-line arguments (-n and -s)
-    // TODO: Initialize the Key-Value Store (hashtable)
-    // TODO: Create server threads
-    // TODO: Wait for server threads to complete
+    if (parse_args(argc, argv) != 0)
+        exit(EXIT_FAILURE);
+
+    // Taken by the snapshot thread alone: every thread inherits this mask
+    sigset_t snapshot_signals;
+    sigemptyset(&snapshot_signals);
+    sigaddset(&snapshot_signals, SIGTERM);
+    sigaddset(&snapshot_signals, SIGINT);
+    if (snapshot_path != NULL)
+        pthread_sigmask(SIG_BLOCK, &snapshot_signals, NULL);
+
+    if (init_server() < 0)
+        exit(EXIT_FAILURE);
+
+    if (snapshot_path != NULL)
+    {
+        int rc = snapshot_open(snapshot_path, &restore);
+        if (rc < 0)
+            exit(EXIT_FAILURE);
+        if (rc > 0)
+        {
+            PRINTV("No snapshot at %s, starting empty\n", snapshot_path);
+        }
+    }
+
+    if (cache_keys > 0)
+    {
+        // Evicting a key means deleting it from whichever table holds it
+        if (hot_replicas || num_partitions > 0)
+        {
+            fprintf(stderr, "--cache can't be combined with --hot or partitioned mode\n");
+            exit(EXIT_FAILURE);
+        }
+        if (cache_init(cache_keys, default_ttl_ms) < 0)
+        {
+            perror("cache_init");
+            exit(EXIT_FAILURE);
+        }
+        if (stats != NULL)
+            stats->cache_capacity = cache_keys;
+        PRINTV("Caching at most %u keys\n", cache_keys);
+    }
+
+    if (hot_replicas && hot_init() < 0)
+    {
+        perror("hot_init");
+        exit(EXIT_FAILURE);
+    }
+
+    void *(*thread_fn)(void *) = num_shards > 0 || registry != NULL ? &server_thread_sharded : &server_thread;
+    if (num_partitions > 0)
+    {
+        // Shared-nothing: one private table per partition, one thread per table
+        if (num_partitions > MAX_THREADS)
+        {
+            fprintf(stderr, "The client set up %u partitions, at most %d are supported\n", num_partitions, MAX_THREADS);
+            exit(EXIT_FAILURE);
+        }
+        if ((uint32_t)num_threads != num_partitions)
+            fprintf(stderr, "Running %u threads, one per partition, instead of %d\n", num_partitions, num_threads);
+        num_threads = num_partitions;
+        thread_fn = &server_thread_partitioned;
+        if (min_threads > 0)
+            fprintf(stderr, "Ignoring --min-threads: every partition needs its thread\n");
+        // Scanning a partition's table would race with its thread
+        if (snapshot_ms > 0)
+        {
+            fprintf(stderr, "--snapshot-ms can't be used in partitioned mode\n");
+            exit(EXIT_FAILURE);
+        }
+        PRINTV("Using the %s backend, partitioned without locks\n", kv->name);
+    }
+    else
+    {
+        if (sync_mode == SYNC_NONE && num_threads > 1)
+        {
+            fprintf(stderr, "-l none needs -n 1 outside partitioned mode\n");
+            exit(EXIT_FAILURE);
+        }
+        ht = kv->create(table_size(1));
+        if (ht == NULL)
+        {
+            perror("create");
+            exit(EXIT_FAILURE);
+        }
+        if (table_set_sync(ht, sync_mode, num_stripes) < 0)
+        {
+            perror("table_set_sync");
+            exit(EXIT_FAILURE);
+        }
+        PRINTV("Using the %s backend with %s synchronization\n", kv->name, sync_names[sync_mode]);
+
+        if (min_threads > 0 && pool_start(min_threads, num_threads, queue_depth, verbose) < 0)
+        {
+            perror("pool_start");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Every thread shares the arena's index, partitioned or not
+    if (ring->arena_size > 0)
+    {
+        if (blob_init(shmem_area, ring->arena_off, ring->arena_size, kv, init_table_size, sync_mode, num_stripes) < 0)
+        {
+            perror("blob_init");
+            exit(EXIT_FAILURE);
+        }
+        PRINTV("Keeping vput values in a %u MiB arena\n", ring->arena_size >> 20);
+    }
+
+    if (restore.map != NULL && restore_snapshot() < 0)
+        exit(EXIT_FAILURE);
+
+    if (snapshot_path != NULL)
+    {
+        pthread_t snapshot_tid;
+        if (pthread_create(&snapshot_tid, NULL, snapshot_thread, &snapshot_signals))
+            perror("pthread_create");
+    }
+
+    if (stats != NULL)
+    {
+        pthread_t stats_tid;
+        stats->nthreads = num_threads;
+        __atomic_store_n(&stats->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+        if (pthread_create(&stats_tid, NULL, stats_thread, NULL))
+            perror("pthread_create");
+    }
+
+    for (long i = 0; i < num_threads; i++)
+        if (pthread_create(&threads[i], NULL, thread_fn, (void *)i))
+            perror("pthread_create");
+
+    for (int i = 0; i < num_threads; i++)
+        if (pthread_join(threads[i], NULL))
+            perror("pthread_join");
     return 0;
-}
\ No newline at end of file
+}
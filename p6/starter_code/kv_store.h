@@ -0,0 +1,353 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "common.h"
+#include "kv_stats.h"
+
+/* Set in bucket_hdr_t.meta once the bucket's keys have moved to the next array */
+#define BUCKET_MIGRATED 0x80000000u
+
+/* Hint to the CPU that we are in a spin-wait loop */
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/* How a table synchronizes access to its buckets - fixed once threads start */
+enum kv_sync
+{
+	SYNC_SEQLOCK = 0, /* Per-bucket spinlock for writers, optimistic lock-free readers */
+	SYNC_SPIN,		  /* Per-bucket spinlock for readers and writers */
+	SYNC_RWLOCK,	  /* Per-bucket reader-writer spinlock */
+	SYNC_STRIPED,	  /* A fixed set of mutexes shared by buckets */
+	SYNC_GLOBAL,	  /* One mutex for the whole table */
+	SYNC_NONE		  /* No locking - the table is private to one thread */
+};
+
+/* Mutex for SYNC_STRIPED/SYNC_GLOBAL, padded so stripes don't share lines */
+typedef struct
+{
+	pthread_mutex_t m;
+} __attribute__((aligned(64))) stripe_lock_t;
+
+/* Every bucket format starts with this header. All-zero is a valid empty,
+ * unlocked bucket, so a new array needs no initialization pass */
+typedef struct
+{
+	/* Per-bucket lock word, meaning depends on enum kv_sync:
+	 * SYNC_SEQLOCK - version, odd while a writer holds the bucket and bumped
+	 *                again on release, so readers can detect changes
+	 * SYNC_SPIN    - 1 while held
+	 * SYNC_RWLOCK  - bit 0 set while a writer holds it, readers count by 2
+	 * Unused by the mutex-based strategies */
+	uint32_t lock;
+	uint32_t meta; /* BUCKET_MIGRATED plus bits owned by the backend */
+} bucket_hdr_t;
+
+/* One generation of a table. While a resize is in progress, the array points
+ * at its twice-as-large successor and buckets move over a few at a time;
+ * old bucket b splits into new buckets b and b + size */
+typedef struct table_array
+{
+	index_t size;
+	char *buckets;
+	struct table_array *next;
+	uint64_t count;			/* Keys stored in this array */
+	index_t migrate_cursor; /* Next bucket to hand out for migration */
+	index_t migrated_count; /* Buckets whose migration has finished */
+} table_array_t;
+
+typedef struct kv_table kv_table_t;
+
+/*
+ * Move every key of a locked bucket into the next array
+ * The destination buckets are only reachable through the source bucket once
+ * it is marked migrated, so they can be written without taking their locks
+ * @return the number of keys moved
+ */
+typedef uint64_t (*migrate_fn)(kv_table_t *t, bucket_hdr_t *b, table_array_t *to);
+
+/* Called for every key a scan visits */
+typedef void (*scan_fn)(void *arg, key_type key, value_type value);
+
+/* Report every key of a locked bucket, overflow included, to fn */
+typedef void (*visit_fn)(bucket_hdr_t *b, scan_fn fn, void *arg);
+
+/* Generation bookkeeping shared by all backends */
+struct kv_table
+{
+	/* Oldest array that may still hold keys - every operation starts here
+	 * and follows next past migrated buckets. Retired arrays are never
+	 * freed because a slow thread may still be walking them; they add up
+	 * to less than the size of the live array */
+	table_array_t *cur;
+	size_t bucket_bytes;
+	uint32_t max_load; /* Average keys per bucket that triggers growth */
+	migrate_fn migrate;
+	visit_fn visit;
+	enum kv_sync sync;
+	uint32_t nstripes;
+	stripe_lock_t *stripes;
+};
+
+static inline bucket_hdr_t *array_bucket(kv_table_t *t, table_array_t *a, index_t index)
+{
+	return (bucket_hdr_t *)(a->buckets + (size_t)index * t->bucket_bytes);
+}
+
+/* Arrays are page aligned, so the bucket's address divided by its size
+ * walks the stripes in index order within each array */
+static inline pthread_mutex_t *stripe_of(kv_table_t *t, bucket_hdr_t *b)
+{
+	return &t->stripes[((uintptr_t)b / t->bucket_bytes) % t->nstripes].m;
+}
+
+/* Take b for writing under the table's strategy */
+static inline void sync_lock(kv_table_t *t, bucket_hdr_t *b)
+{
+	uint32_t w;
+	switch (t->sync)
+	{
+	case SYNC_SEQLOCK:
+		/* Move the version from even to odd. The release fence keeps the
+		 * writes that follow from becoming visible before the odd version,
+		 * so readers racing with us always fail validation */
+		w = __atomic_load_n(&b->lock, __ATOMIC_RELAXED);
+		while ((w & 1) || !__atomic_compare_exchange_n(&b->lock, &w, w + 1, true,
+													   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			thread_stats->lock_fails++;
+			cpu_relax();
+			w = __atomic_load_n(&b->lock, __ATOMIC_RELAXED);
+		}
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		break;
+	case SYNC_SPIN:
+	case SYNC_RWLOCK:
+		/* Wait for the word to drop to 0 (no writer, no readers) */
+		w = 0;
+		while (!__atomic_compare_exchange_n(&b->lock, &w, 1, true,
+											__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			thread_stats->lock_fails++;
+			cpu_relax();
+			w = 0;
+		}
+		break;
+	case SYNC_STRIPED:
+	case SYNC_GLOBAL:
+		if (pthread_mutex_trylock(stripe_of(t, b)) != 0)
+		{
+			thread_stats->lock_fails++;
+			pthread_mutex_lock(stripe_of(t, b));
+		}
+		break;
+	case SYNC_NONE:
+		break;
+	}
+}
+
+static inline void sync_unlock(kv_table_t *t, bucket_hdr_t *b)
+{
+	switch (t->sync)
+	{
+	case SYNC_SEQLOCK:
+		/* Back to an even version, one higher than readers saw before */
+		__atomic_store_n(&b->lock, b->lock + 1, __ATOMIC_RELEASE);
+		break;
+	case SYNC_SPIN:
+	case SYNC_RWLOCK:
+		__atomic_store_n(&b->lock, 0, __ATOMIC_RELEASE);
+		break;
+	case SYNC_STRIPED:
+	case SYNC_GLOBAL:
+		pthread_mutex_unlock(stripe_of(t, b));
+		break;
+	case SYNC_NONE:
+		break;
+	}
+}
+
+/* Take b for reading - never called for SYNC_SEQLOCK */
+static inline void sync_lock_shared(kv_table_t *t, bucket_hdr_t *b)
+{
+	if (t->sync != SYNC_RWLOCK)
+	{
+		sync_lock(t, b);
+		return;
+	}
+	uint32_t w = __atomic_load_n(&b->lock, __ATOMIC_RELAXED);
+	while ((w & 1) || !__atomic_compare_exchange_n(&b->lock, &w, w + 2, true,
+												   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	{
+		thread_stats->lock_fails++;
+		cpu_relax();
+		w = __atomic_load_n(&b->lock, __ATOMIC_RELAXED);
+	}
+}
+
+static inline void sync_unlock_shared(kv_table_t *t, bucket_hdr_t *b)
+{
+	if (t->sync == SYNC_RWLOCK)
+		__atomic_fetch_sub(&b->lock, 2, __ATOMIC_RELEASE);
+	else
+		sync_unlock(t, b);
+}
+
+/*
+ * Initialize t with a first array of size buckets of bucket_bytes each
+ * @return 0 on success, -1 if the array could not be allocated
+ */
+int table_init(kv_table_t *t, index_t size, size_t bucket_bytes, uint32_t max_load, migrate_fn migrate, visit_fn visit);
+
+/*
+ * Choose how t synchronizes - must be called before any thread uses it
+ * @param nstripes number of mutexes for SYNC_STRIPED, ignored otherwise
+ * @return 0 on success, -1 if the stripe locks could not be allocated
+ */
+int table_set_sync(kv_table_t *t, enum kv_sync sync, uint32_t nstripes);
+
+/*
+ * Find and lock the bucket that currently owns key
+ * @param arr set to the array the bucket belongs to
+ */
+bucket_hdr_t *table_lock_bucket(kv_table_t *t, key_type key, table_array_t **arr);
+
+void table_unlock_bucket(kv_table_t *t, bucket_hdr_t *b);
+
+/* Do this operation's share of an in-progress resize - call before each put */
+void table_migrate_step(kv_table_t *t);
+
+/* Start pulling key's home bucket into the cache ahead of a lookup
+ * Only a hint: the bucket may be migrated by the time it is read */
+static inline void table_prefetch(kv_table_t *t, key_type key)
+{
+	table_array_t *a = __atomic_load_n(&t->cur, __ATOMIC_ACQUIRE);
+	__builtin_prefetch(array_bucket(t, a, hash_function(key, a->size)));
+}
+
+/*
+ * Find the bucket that currently owns key for reading
+ * Under SYNC_SEQLOCK this never writes shared memory: it waits out a writer
+ * holding the bucket and returns its version. Every other strategy takes the
+ * bucket's lock in shared mode.
+ * Every call must be paired with table_read_done.
+ * @param seq set to the bucket's version, to be passed to table_read_valid
+ */
+static inline bucket_hdr_t *table_read_bucket(kv_table_t *t, key_type key, uint32_t *seq)
+{
+	table_array_t *a = __atomic_load_n(&t->cur, __ATOMIC_ACQUIRE);
+	while (1)
+	{
+		bucket_hdr_t *b = array_bucket(t, a, hash_function(key, a->size));
+		if (t->sync == SYNC_SEQLOCK)
+		{
+			uint32_t s;
+			while ((s = __atomic_load_n(&b->lock, __ATOMIC_ACQUIRE)) & 1)
+			{
+				thread_stats->lock_fails++;
+				cpu_relax();
+			}
+			/* The migrated bit is only set by a writer, so if it is clear
+			 * here and the version still matches later, the bucket was live */
+			if (!(__atomic_load_n(&b->meta, __ATOMIC_ACQUIRE) & BUCKET_MIGRATED))
+			{
+				*seq = s;
+				return b;
+			}
+		}
+		else
+		{
+			sync_lock_shared(t, b);
+			if (!(b->meta & BUCKET_MIGRATED))
+			{
+				*seq = 0;
+				return b;
+			}
+			sync_unlock_shared(t, b);
+		}
+		a = __atomic_load_n(&a->next, __ATOMIC_ACQUIRE);
+	}
+}
+
+/*
+ * Check that nothing wrote to b since table_read_bucket returned seq
+ * Always true when the bucket is locked for reading
+ * @return true if everything read from the bucket since then is consistent
+ */
+static inline bool table_read_valid(kv_table_t *t, bucket_hdr_t *b, uint32_t seq)
+{
+	if (t->sync != SYNC_SEQLOCK)
+		return true;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&b->lock, __ATOMIC_RELAXED) == seq;
+}
+
+/*
+ * Finish a read started with table_read_bucket
+ * @return true if the values read are consistent, false if the read must be
+ * retried from table_read_bucket
+ */
+static inline bool table_read_done(kv_table_t *t, bucket_hdr_t *b, uint32_t seq)
+{
+	if (t->sync == SYNC_SEQLOCK)
+	{
+		if (table_read_valid(t, b, seq))
+			return true;
+		thread_stats->read_retries++;
+		return false;
+	}
+	sync_unlock_shared(t, b);
+	return true;
+}
+
+/* Account for n keys inserted into a, growing the table if it is too full */
+void table_added(kv_table_t *t, table_array_t *a, uint64_t n);
+
+/* Account for n keys removed from a */
+void table_removed(kv_table_t *t, table_array_t *a, uint64_t n);
+
+/*
+ * Scanning: table_scan_start returns the array to scan, then table_scan
+ * visits its buckets first to first + count - 1 (up to the array's size),
+ * each under its lock for just as long as it takes to report its keys.
+ * Buckets that a resize moved on are followed into the next array, so every
+ * key present for the whole scan is reported exactly once, whatever the
+ * resizes do. Call from any thread, as long as t is not SYNC_NONE or no
+ * other thread uses it.
+ */
+table_array_t *table_scan_start(kv_table_t *t);
+void table_scan(kv_table_t *t, table_array_t *a, index_t first, index_t count, scan_fn fn, void *arg);
+
+/*
+ * Add t's size to the table-wide fields of s: keys (approximate while a
+ * resize is under way), buckets of the newest array, and resize progress
+ * Safe to call from any thread while others use the table
+ */
+void table_stats(kv_table_t *t, struct kv_stats *s);
+
+/* A KV store implementation the server can be started with */
+struct kv_backend
+{
+	const char *name;
+	/* size is the initial table size from -s, in keys */
+	kv_table_t *(*create)(index_t size);
+	/* Insert key, or update its value if it is already in the table */
+	void (*put)(kv_table_t *t, key_type key, value_type value);
+	/* Return the value stored for key, 0 if the key is not in the table */
+	value_type (*get)(kv_table_t *t, key_type key);
+	/* Remove key if it is in the table. The space it used is reclaimed on
+	 * the spot, so churn leaves neither longer probes nor a bigger table */
+	void (*del)(kv_table_t *t, key_type key);
+};
+
+/* Linked chains, one node per key (kv_chain.c) */
+extern const struct kv_backend chain_backend;
+/* Cache-line buckets of packed keys probed with SIMD compares (kv_bucket.c) */
+extern const struct kv_backend bucket_backend;
@@ -0,0 +1,214 @@
+#include "kv_store.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// Buckets each operation moves to the new array while a resize is running
+#define MIGRATE_STEP 2
+
+// Counters of threads that are not server workers
+static struct kv_thread_stats stats_scratch;
+__thread struct kv_thread_stats *thread_stats = &stats_scratch;
+
+void stats_attach_thread(struct kv_stats *s, int worker)
+{
+    if (s != NULL && worker < STATS_MAX_THREADS)
+        thread_stats = &s->threads[worker];
+    else if ((thread_stats = calloc(1, sizeof(struct kv_thread_stats))) == NULL)
+        thread_stats = &stats_scratch;
+}
+
+// Allocate an empty array with size buckets, NULL on failure
+// Anonymous mappings are page aligned (so buckets never straddle cache
+// lines) and zero-filled lazily by the kernel, so growing a large table
+// costs no up-front pass over the new array
+static table_array_t *alloc_array(kv_table_t *t, index_t size)
+{
+    table_array_t *a = calloc(1, sizeof(table_array_t));
+    if (a == NULL)
+        return NULL;
+    a->size = size;
+    a->buckets = mmap(NULL, (size_t)size * t->bucket_bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (a->buckets == MAP_FAILED)
+    {
+        free(a);
+        return NULL;
+    }
+    return a;
+}
+
+static void free_array(kv_table_t *t, table_array_t *a)
+{
+    munmap(a->buckets, (size_t)a->size * t->bucket_bytes);
+    free(a);
+}
+
+int table_init(kv_table_t *t, index_t size, size_t bucket_bytes, uint32_t max_load, migrate_fn migrate, visit_fn visit)
+{
+    t->bucket_bytes = bucket_bytes;
+    t->max_load = max_load;
+    t->migrate = migrate;
+    t->visit = visit;
+    t->sync = SYNC_SEQLOCK;
+    t->nstripes = 0;
+    t->stripes = NULL;
+    t->cur = alloc_array(t, size > 0 ? size : 1);
+    return t->cur == NULL ? -1 : 0;
+}
+
+int table_set_sync(kv_table_t *t, enum kv_sync sync, uint32_t nstripes)
+{
+    t->sync = sync;
+    if (sync != SYNC_STRIPED && sync != SYNC_GLOBAL)
+        return 0;
+
+    t->nstripes = sync == SYNC_GLOBAL || nstripes == 0 ? 1 : nstripes;
+    t->stripes = aligned_alloc(64, t->nstripes * sizeof(stripe_lock_t));
+    if (t->stripes == NULL)
+        return -1;
+    for (uint32_t i = 0; i < t->nstripes; i++)
+        pthread_mutex_init(&t->stripes[i].m, NULL);
+    return 0;
+}
+
+// Start growing a into an array twice its size
+// Only the array every operation starts from may grow, so at most one
+// migration is in flight; losing the race to install next is harmless
+static void start_resize(kv_table_t *t, table_array_t *a)
+{
+    if (a != __atomic_load_n(&t->cur, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&a->next, __ATOMIC_ACQUIRE) != NULL ||
+        a->size > INT32_MAX / 2) // hash_function takes an int table size
+        return;
+
+    table_array_t *next = alloc_array(t, a->size * 2);
+    if (next == NULL)
+        return; // Keep running at a higher load
+
+    table_array_t *expected = NULL;
+    if (!__atomic_compare_exchange_n(&a->next, &expected, next, false,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        free_array(t, next);
+}
+
+// Move one bucket to the next array and mark it migrated
+static void migrate_bucket(kv_table_t *t, table_array_t *a, index_t index)
+{
+    table_array_t *to = a->next;
+    bucket_hdr_t *b = array_bucket(t, a, index);
+
+    sync_lock(t, b);
+    uint64_t moved = t->migrate(t, b, to);
+    __atomic_or_fetch(&b->meta, BUCKET_MIGRATED, __ATOMIC_RELEASE);
+    sync_unlock(t, b);
+
+    __atomic_fetch_add(&to->count, moved, __ATOMIC_RELAXED);
+    thread_stats->migrated++;
+}
+
+// The thread that finishes the last bucket retires the old array
+void table_migrate_step(kv_table_t *t)
+{
+    table_array_t *a = __atomic_load_n(&t->cur, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&a->next, __ATOMIC_ACQUIRE) == NULL)
+        return;
+
+    for (int i = 0; i < MIGRATE_STEP; i++)
+    {
+        if (__atomic_load_n(&a->migrate_cursor, __ATOMIC_RELAXED) >= a->size)
+            return;
+        index_t index = __atomic_fetch_add(&a->migrate_cursor, 1, __ATOMIC_RELAXED);
+        if (index >= a->size)
+            return;
+
+        migrate_bucket(t, a, index);
+        if (__atomic_add_fetch(&a->migrated_count, 1, __ATOMIC_ACQ_REL) == a->size)
+            __atomic_store_n(&t->cur, a->next, __ATOMIC_RELEASE);
+    }
+}
+
+bucket_hdr_t *table_lock_bucket(kv_table_t *t, key_type key, table_array_t **arr)
+{
+    table_array_t *a = __atomic_load_n(&t->cur, __ATOMIC_ACQUIRE);
+    while (1)
+    {
+        bucket_hdr_t *b = array_bucket(t, a, hash_function(key, a->size));
+        sync_lock(t, b);
+        if (!(b->meta & BUCKET_MIGRATED))
+        {
+            *arr = a;
+            return b;
+        }
+        sync_unlock(t, b);
+        a = __atomic_load_n(&a->next, __ATOMIC_ACQUIRE);
+    }
+}
+
+void table_unlock_bucket(kv_table_t *t, bucket_hdr_t *b)
+{
+    sync_unlock(t, b);
+}
+
+void table_added(kv_table_t *t, table_array_t *a, uint64_t n)
+{
+    uint64_t count = __atomic_add_fetch(&a->count, n, __ATOMIC_RELAXED);
+    if (count > (uint64_t)a->size * t->max_load)
+        start_resize(t, a);
+}
+
+void table_removed(kv_table_t *t, table_array_t *a, uint64_t n)
+{
+    (void)t;
+    __atomic_sub_fetch(&a->count, n, __ATOMIC_RELAXED);
+}
+
+table_array_t *table_scan_start(kv_table_t *t)
+{
+    return __atomic_load_n(&t->cur, __ATOMIC_ACQUIRE);
+}
+
+// Old bucket index splits into buckets index and index + size of the next
+// array, which hold exactly its keys once it is marked migrated
+static void scan_bucket(kv_table_t *t, table_array_t *a, index_t index, scan_fn fn, void *arg)
+{
+    bucket_hdr_t *b = array_bucket(t, a, index);
+    sync_lock(t, b);
+    bool migrated = b->meta & BUCKET_MIGRATED;
+    if (!migrated)
+        t->visit(b, fn, arg);
+    sync_unlock(t, b);
+    if (!migrated)
+        return;
+
+    table_array_t *next = __atomic_load_n(&a->next, __ATOMIC_ACQUIRE);
+    scan_bucket(t, next, index, fn, arg);
+    scan_bucket(t, next, index + a->size, fn, arg);
+}
+
+void table_scan(kv_table_t *t, table_array_t *a, index_t first, index_t count, scan_fn fn, void *arg)
+{
+    for (index_t i = first; i < a->size && i - first < count; i++)
+        scan_bucket(t, a, i, fn, arg);
+}
+
+void table_stats(kv_table_t *t, struct kv_stats *s)
+{
+    table_array_t *a = __atomic_load_n(&t->cur, __ATOMIC_ACQUIRE);
+    table_array_t *next = __atomic_load_n(&a->next, __ATOMIC_ACQUIRE);
+    uint64_t count = __atomic_load_n(&a->count, __ATOMIC_RELAXED);
+    if (next == NULL)
+    {
+        s->keys += count;
+        s->buckets += a->size;
+        return;
+    }
+
+    // Keys that already moved are counted in next, assume the ones left
+    // in a are spread evenly over its unmigrated buckets
+    index_t done = __atomic_load_n(&a->migrated_count, __ATOMIC_RELAXED);
+    s->keys += __atomic_load_n(&next->count, __ATOMIC_RELAXED) + count * (a->size - done) / a->size;
+    s->buckets += next->size;
+    s->resize_total += a->size;
+    s->resize_done += done;
+}
@@ -0,0 +1,188 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "ring_buffer.h"
+#include "kv_stats.h"
+
+// Header lines are repeated this often, like vmstat
+#define ROWS_PER_HEADER 20
+
+const char *path = "shmem_file";
+int interval_ms = 1000;
+int count = 0; // 0 runs until killed
+int per_thread = 0;
+int cache_mode = 0; // The server runs with --cache: add its hit rate and evictions
+
+// Map path read-only and find the server's statistics in it
+static struct kv_stats *map_stats(void)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        perror("fstat");
+        close(fd);
+        return NULL;
+    }
+    char *mem = st.st_size >= (off_t)sizeof(struct ring) ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s\n", path);
+        return NULL;
+    }
+
+    uint32_t off = ((struct ring *)mem)->stats_off;
+    struct kv_stats *s = (struct kv_stats *)(mem + off);
+    if (off == 0 || off + sizeof(struct kv_stats) > (size_t)st.st_size ||
+        __atomic_load_n(&s->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC)
+    {
+        fprintf(stderr, "No server statistics in %s - is a server running on it?\n", path);
+        return NULL;
+    }
+    return s;
+}
+
+// Sum of the threads' counters
+static void total(const struct kv_stats *s, struct kv_thread_stats *sum)
+{
+    uint32_t n = s->nthreads < STATS_MAX_THREADS ? s->nthreads : STATS_MAX_THREADS;
+    memset(sum, 0, sizeof(*sum));
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const uint64_t *src = (const uint64_t *)&s->threads[i];
+        uint64_t *dst = (uint64_t *)sum;
+        for (size_t j = 0; j < sizeof(*sum) / sizeof(uint64_t); j++)
+            dst[j] += src[j];
+    }
+}
+
+static void print_header(void)
+{
+    printf("%8s %10s %10s %10s %10s %10s %10s %6s %10s %10s %10s %6s", "", "get/s", "put/s", "del/s", "mget/s", "mput/s",
+           "bursts/s", "coal%", "empty/s", "lockfail/s", "retry/s", "probe");
+    if (cache_mode)
+        printf(" %6s %10s %10s", "hit%", "evict/s", "expire/s");
+    printf(" %12s %6s %7s\n", "keys", "load", "resize");
+}
+
+// One line of rates between two snapshots of a thread (or the total)
+static void print_rates(const char *name, const struct kv_thread_stats *a, const struct kv_thread_stats *b, double secs)
+{
+    uint64_t gets = b->ops[GET] - a->ops[GET];
+    uint64_t lookups = b->lookups - a->lookups;
+    printf("%8s %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f %6.1f %10.0f %10.0f %10.0f %6.2f", name,
+           gets / secs, (b->ops[PUT] - a->ops[PUT]) / secs, (b->ops[DEL] - a->ops[DEL]) / secs,
+           (b->ops[MGET] - a->ops[MGET]) / secs, (b->ops[MPUT] - a->ops[MPUT]) / secs,
+           (b->bursts - a->bursts) / secs,
+           gets > 0 ? 100.0 * (b->coalesced - a->coalesced) / gets : 0.0,
+           (b->empty_polls - a->empty_polls) / secs,
+           (b->lock_fails - a->lock_fails) / secs,
+           (b->read_retries - a->read_retries) / secs,
+           lookups > 0 ? (double)(b->probes - a->probes) / lookups : 0.0);
+    if (!cache_mode)
+        return;
+    uint64_t hits = b->cache_hits - a->cache_hits;
+    uint64_t reads = hits + b->cache_misses - a->cache_misses;
+    printf(" %6.1f %10.0f %10.0f", reads > 0 ? 100.0 * hits / reads : 0.0,
+           (b->cache_evictions - a->cache_evictions) / secs, (b->cache_expired - a->cache_expired) / secs);
+}
+
+static int parse_args(int argc, char **argv)
+{
+    int op;
+    while ((op = getopt(argc, argv, "hi:n:t")) != -1)
+    {
+        switch (op)
+        {
+        case 'i':
+            interval_ms = atoi(optarg);
+            break;
+
+        case 'n':
+            count = atoi(optarg);
+            break;
+
+        case 't':
+            per_thread = 1;
+            break;
+
+        default:
+            printf("Usage: %s [-h] [-i interval_ms] [-n count] [-t] [file]\n", argv[0]);
+            printf("Print the rates of a running server's counters from the region it shares with clients\n");
+            printf("-i milliseconds between lines (default: 1000)\n");
+            printf("-n stop after this many lines (default: run until killed)\n");
+            printf("-t also print a line per server thread\n");
+            printf("file the region: shmem_file (default), or the file of a server started with --listen - a --memfd region can't be read\n");
+            exit(op == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (optind < argc)
+        path = argv[optind];
+    if (interval_ms <= 0)
+        interval_ms = 1000;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    struct kv_stats *s = map_stats();
+    if (s == NULL)
+        return EXIT_FAILURE;
+    cache_mode = s->cache_capacity > 0;
+
+    size_t size = sizeof(struct kv_stats);
+    struct kv_stats *prev = malloc(size), *cur = malloc(size);
+    if (prev == NULL || cur == NULL)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    memcpy(prev, s, size);
+    struct timespec period = {interval_ms / 1000, (interval_ms % 1000) * 1000000L};
+
+    for (int line = 0; count == 0 || line < count; line++)
+    {
+        nanosleep(&period, NULL);
+        memcpy(cur, s, size);
+        if (line % ROWS_PER_HEADER == 0 || per_thread)
+            print_header();
+
+        struct kv_thread_stats a, b;
+        total(prev, &a);
+        total(cur, &b);
+        double secs = interval_ms / 1e3;
+        print_rates("total", &a, &b, secs);
+        printf(" %12lu %6.2f", cur->keys, cur->buckets > 0 ? (double)cur->keys / cur->buckets : 0.0);
+        if (cur->resize_total > 0)
+            printf(" %6.1f%%\n", 100.0 * cur->resize_done / cur->resize_total);
+        else
+            printf(" %7s\n", "-");
+
+        for (uint32_t i = 0; per_thread && i < cur->nthreads && i < STATS_MAX_THREADS; i++)
+        {
+            char name[16];
+            snprintf(name, sizeof(name), "%u", i);
+            print_rates(name, &prev->threads[i], &cur->threads[i], secs);
+            printf("\n");
+        }
+        fflush(stdout);
+
+        struct kv_stats *tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+    return EXIT_SUCCESS;
+}
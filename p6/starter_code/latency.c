@@ -0,0 +1,79 @@
+#include "latency.h"
+#include <stdio.h>
+
+// Lowest value that lands in bucket idx, the inverse of hist_record
+static uint64_t bucket_value(unsigned idx)
+{
+    if (idx < 2 * HIST_HALF)
+        return idx;
+    unsigned shift = idx / HIST_HALF - 1;
+    return (uint64_t)(idx - shift * HIST_HALF) << shift;
+}
+
+void hist_merge(struct histogram *dst, const struct histogram *src)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+uint64_t hist_percentile(const struct histogram *h, double p)
+{
+    if (h->count == 0)
+        return 0;
+    uint64_t rank = h->count * p / 100;
+    if (rank >= h->count)
+        return h->max;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen > rank)
+            return bucket_value(i);
+    }
+    return h->max;
+}
+
+// A timestamp pair out of order (e.g. a request the server never stamped)
+// counts as 0 rather than wrapping around
+static uint64_t elapsed(uint64_t from, uint64_t to)
+{
+    return to > from ? to - from : 0;
+}
+
+void latency_record(struct latency_stats *s, uint64_t t_submit, uint64_t t_dequeue, uint64_t t_complete, uint64_t seen_ns)
+{
+    hist_record(&s->queue, elapsed(t_submit, t_dequeue));
+    hist_record(&s->service, elapsed(t_dequeue, t_complete));
+    hist_record(&s->notify, elapsed(t_complete, seen_ns));
+    hist_record(&s->total, elapsed(t_submit, seen_ns));
+}
+
+void latency_merge(struct latency_stats *dst, const struct latency_stats *src)
+{
+    hist_merge(&dst->queue, &src->queue);
+    hist_merge(&dst->service, &src->service);
+    hist_merge(&dst->notify, &src->notify);
+    hist_merge(&dst->total, &src->total);
+}
+
+static void print_row(const char *name, const struct histogram *h)
+{
+    static const double pcts[] = {50, 90, 99, 99.9};
+    printf("%-8s", name);
+    for (int i = 0; i < 4; i++)
+        printf(" %10.2f", hist_percentile(h, pcts[i]) / 1e3);
+    printf(" %10.2f\n", h->max / 1e3);
+}
+
+void latency_print(const struct latency_stats *s)
+{
+    printf("Latency (us) over %lu requests\n", s->total.count);
+    printf("%-8s %10s %10s %10s %10s %10s\n", "", "p50", "p90", "p99", "p99.9", "max");
+    print_row("queue", &s->queue);
+    print_row("service", &s->service);
+    print_row("notify", &s->notify);
+    print_row("total", &s->total);
+}
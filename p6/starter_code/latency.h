@@ -0,0 +1,66 @@
+#pragma once
+#include <stdint.h>
+#include <time.h>
+
+/* Request timestamps are CLOCK_MONOTONIC nanoseconds, which the client and
+ * the server read from the same clock when they run on one machine */
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Log-bucketed latency histogram: values below 2^HIST_SUB_BITS have a bucket
+ * each, above that every power of two is split into 2^(HIST_SUB_BITS - 1)
+ * buckets, so a recorded value is off by at most 1/16 (about 6%) */
+#define HIST_SUB_BITS 5
+#define HIST_HALF (1 << (HIST_SUB_BITS - 1))
+#define HIST_BUCKETS (64 * HIST_HALF)
+
+struct histogram {
+	uint64_t count;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+static inline void hist_record(struct histogram *h, uint64_t v)
+{
+	unsigned idx = v;
+	if (v >= 2 * HIST_HALF) {
+		unsigned shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS + 1;
+		idx = shift * HIST_HALF + (v >> shift);
+	}
+	h->buckets[idx]++;
+	h->count++;
+	if (v > h->max)
+		h->max = v;
+}
+
+/* Add the counts of src to dst */
+void hist_merge(struct histogram *dst, const struct histogram *src);
+
+/*
+ * @param p Percentile in [0, 100]
+ * @return The lowest value of the bucket holding the p-th percentile, 0 if
+ * the histogram is empty
+ */
+uint64_t hist_percentile(const struct histogram *h, double p);
+
+/* Where a traced request spent its time */
+struct latency_stats {
+	struct histogram queue;	  /* submitted -> dequeued by a server thread */
+	struct histogram service; /* dequeued -> completed, including the requests ahead of it in its burst */
+	struct histogram notify;  /* completed -> seen by the client thread */
+	struct histogram total;	  /* submitted -> seen */
+};
+
+/* Record one completed request from its timestamps, seen_ns being when the
+ * client found it complete */
+void latency_record(struct latency_stats *s, uint64_t t_submit, uint64_t t_dequeue, uint64_t t_complete, uint64_t seen_ns);
+
+/* Add the histograms of src to dst */
+void latency_merge(struct latency_stats *dst, const struct latency_stats *src);
+
+/* Print p50/p90/p99/p99.9/max of each histogram, in microseconds */
+void latency_print(const struct latency_stats *s);
@@ -0,0 +1,115 @@
+#include "registry.h"
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+static uint64_t align64(uint64_t off)
+{
+    return (off + 63) & ~(uint64_t)63;
+}
+
+size_t registry_region_size(uint32_t max_clients, uint32_t client_rings, uint64_t segment_size)
+{
+    uint64_t rings_off = align64(sizeof(struct ring) + sizeof(struct attach_registry));
+    uint64_t segments_off = rings_off + (uint64_t)max_clients * client_rings * sizeof(struct ring);
+    uint64_t size = segments_off + max_clients * align64(segment_size);
+    return size > INT32_MAX ? 0 : size;
+}
+
+struct attach_registry *registry_init(char *base, uint32_t max_clients, uint32_t client_rings, uint64_t segment_size)
+{
+    init_ring((struct ring *)base);
+    struct attach_registry *reg = (struct attach_registry *)(base + sizeof(struct ring));
+    reg->max_clients = max_clients;
+    reg->client_rings = client_rings;
+    reg->rings_off = align64(sizeof(struct ring) + sizeof(struct attach_registry));
+    reg->segments_off = reg->rings_off + (uint64_t)max_clients * client_rings * sizeof(struct ring);
+    reg->segment_size = align64(segment_size);
+    // Published last: a client that sees the magic sees the whole layout
+    __atomic_store_n(&reg->magic, REGISTRY_MAGIC, __ATOMIC_RELEASE);
+    return reg;
+}
+
+struct attach_registry *registry_find(char *base)
+{
+    struct attach_registry *reg = (struct attach_registry *)(base + sizeof(struct ring));
+    if (__atomic_load_n(&reg->magic, __ATOMIC_ACQUIRE) != REGISTRY_MAGIC)
+        return NULL;
+    return reg;
+}
+
+// A slot can be reclaimed if the process that holds it no longer exists
+static int holder_exited(struct attach_slot *s)
+{
+    pid_t pid = __atomic_load_n(&s->pid, __ATOMIC_RELAXED);
+    return pid > 0 && kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+// Take slot s, currently in state from, for the calling process
+// Sequentially consistent, like registry_enter: either a server thread sees
+// the slot is no longer active, or we see it in users
+static int claim(struct attach_slot *s, uint32_t from)
+{
+    return __atomic_compare_exchange_n(&s->state, &from, ATTACH_CLAIMED, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+int registry_attach(struct attach_registry *reg, uint32_t nrings)
+{
+    if (nrings == 0 || nrings > reg->client_rings)
+        return -1;
+
+    int slot = -1;
+    for (uint32_t c = 0; c < reg->max_clients && slot < 0; c++)
+        if (claim(&reg->slots[c], ATTACH_FREE))
+            slot = c;
+    for (uint32_t c = 0; c < reg->max_clients && slot < 0; c++)
+    {
+        struct attach_slot *s = &reg->slots[c];
+        uint32_t state = __atomic_load_n(&s->state, __ATOMIC_RELAXED);
+        if (state != ATTACH_FREE && holder_exited(s) && claim(s, state))
+            slot = c;
+    }
+    if (slot < 0)
+        return -1;
+
+    // Server threads that entered while the slot was active may still be
+    // taking requests from its rings or completing them into its segment
+    struct attach_slot *s = &reg->slots[slot];
+    while (__atomic_load_n(&s->users, __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+
+    __atomic_store_n(&s->pid, getpid(), __ATOMIC_RELAXED);
+    s->nrings = nrings;
+    struct ring *rings = registry_rings(reg, slot);
+    for (uint32_t i = 0; i < nrings; i++)
+        init_ring(&rings[i]);
+    memset((char *)reg - sizeof(struct ring) + registry_segment_off(reg, slot), 0, reg->segment_size);
+
+    // Server threads start polling the rings once they see the slot active
+    __atomic_store_n(&s->state, ATTACH_ACTIVE, __ATOMIC_RELEASE);
+    return slot;
+}
+
+void registry_detach(struct attach_registry *reg, int slot)
+{
+    __atomic_store_n(&reg->slots[slot].state, ATTACH_FREE, __ATOMIC_RELEASE);
+}
+
+bool registry_enter(struct attach_registry *reg, uint32_t c)
+{
+    struct attach_slot *s = &reg->slots[c];
+    __atomic_add_fetch(&s->users, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->state, __ATOMIC_SEQ_CST) == ATTACH_ACTIVE)
+        return true;
+    __atomic_sub_fetch(&s->users, 1, __ATOMIC_RELEASE);
+    return false;
+}
+
+void registry_leave(struct attach_registry *reg, uint32_t c)
+{
+    __atomic_sub_fetch(&reg->slots[c].users, 1, __ATOMIC_RELEASE);
+}
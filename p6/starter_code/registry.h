@@ -0,0 +1,102 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "ring_buffer.h"
+
+/*
+ * Listen mode: the server creates and owns the shared region, and any number
+ * of client processes attach to it, run, and detach while the table stays
+ * warm. The region is laid out as follows:
+ * | DOORBELL RING | REGISTRY | CLIENT_0_RINGS | ... | CLIENT_M_RINGS | CLIENT_0_SEGMENT | ... |
+ * Client c submits through its own rings, one per thread, and lays out its
+ * board (and bells, payloads, completion rings) inside its own segment
+ * exactly as it would in a region of its own. Server threads poll the rings
+ * of every active client and sleep on the doorbell when all are empty.
+ */
+
+#define REGISTRY_MAGIC 0x4b565231 /* "KVR1" */
+#define MAX_ATTACH_CLIENTS 64
+
+enum attach_state {
+	ATTACH_FREE = 0,
+	ATTACH_CLAIMED, /* A client waits for server threads to leave the slot, then
+					 * sets up its rings and segment */
+	ATTACH_ACTIVE	/* Server threads poll the client's rings */
+};
+
+/* One client's entry, on its own cache line */
+struct __attribute__((aligned(64))) attach_slot {
+	uint32_t state;
+	int32_t pid;
+	uint32_t nrings; /* Rings in use, one per client thread */
+	uint32_t users;	 /* Server threads inside the rings, or serving requests
+					  * taken from them (see registry_enter) */
+};
+
+struct __attribute__((aligned(64))) attach_registry {
+	uint32_t magic;
+	uint32_t max_clients;
+	uint32_t client_rings; /* Rings reserved for each client */
+	uint64_t rings_off;	   /* Byte offsets from the start of the region */
+	uint64_t segments_off;
+	uint64_t segment_size;
+	struct attach_slot slots[MAX_ATTACH_CLIENTS];
+};
+
+/*
+ * Size of a region for max_clients clients with client_rings rings and a
+ * segment of segment_size bytes each
+ * @return The size in bytes, 0 if the region would be too big to address
+ * with the int offsets of buffer_descriptor
+ */
+size_t registry_region_size(uint32_t max_clients, uint32_t client_rings, uint64_t segment_size);
+
+/*
+ * Server side: lay out a zeroed region of registry_region_size bytes
+ * @return The registry, which follows the doorbell ring at the start of base
+ */
+struct attach_registry *registry_init(char *base, uint32_t max_clients, uint32_t client_rings, uint64_t segment_size);
+
+/*
+ * Client side: find the registry in a region created by registry_init
+ * @return The registry, NULL if base does not hold one
+ */
+struct attach_registry *registry_find(char *base);
+
+/* First submission ring of client slot c */
+static inline struct ring *registry_rings(struct attach_registry *reg, uint32_t c)
+{
+	return (struct ring *)((char *)reg - sizeof(struct ring) + reg->rings_off) + (size_t)c * reg->client_rings;
+}
+
+/* Byte offset of client slot c's segment from the start of the region */
+static inline uint64_t registry_segment_off(struct attach_registry *reg, uint32_t c)
+{
+	return reg->segments_off + c * reg->segment_size;
+}
+
+/*
+ * Claim a client slot with nrings freshly initialized rings and a zeroed
+ * segment. A free slot is preferred; otherwise the slot of a client process
+ * that exited without detaching is reclaimed. Either way, the rings and
+ * segment are only reset once no server thread is in the slot any more, so
+ * a request of the previous holder is never completed into the new board
+ * @return The slot number, -1 if nrings is too many or every slot is taken
+ */
+int registry_attach(struct attach_registry *reg, uint32_t nrings);
+
+/*
+ * Give the slot back - every request the client submitted must have
+ * completed, so the server holds no reference to its rings or segment
+ */
+void registry_detach(struct attach_registry *reg, int slot);
+
+/*
+ * Server side: enter slot c before taking requests from its rings, and
+ * leave it once every request taken has been completed
+ * @return true if the slot is active and was entered, false if it is not
+ * (and was not entered)
+ */
+bool registry_enter(struct attach_registry *reg, uint32_t c);
+void registry_leave(struct attach_registry *reg, uint32_t c);
@@ -1,14 +1,121 @@
-#include "ring_buffer.h"
-
 #include "ring_buffer.h"
 #include <stdio.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+_Static_assert((RING_SIZE & RING_MASK) == 0, "RING_SIZE must be a power of two");
+
+// Number of pause iterations before a thread waiting on its predecessors
+// in ring_publish yields the CPU
+#define RING_SPIN_LIMIT 128
+// Bounds for the adaptive spin before sleeping on an empty or full ring
+#define RING_WAIT_SPIN_MIN 64
+#define RING_WAIT_SPIN_MAX 16384
+
+// Per-thread spin budget: doubled when spinning was enough to see the ring
+// change, halved when the thread had to sleep anyway
+static __thread unsigned wait_spin_budget = RING_WAIT_SPIN_MAX / 4;
+
+struct ring_waiter
+{
+    unsigned spins;
+    bool slept;
+};
+
+// Hint to the CPU that we are in a spin-wait loop
+static inline void ring_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Back off while waiting on another thread: spin for a while, then yield
+static inline void ring_backoff(unsigned *spins)
+{
+    if (++(*spins) < RING_SPIN_LIMIT)
+        ring_pause();
+    else
+    {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+static inline long futex(uint32_t *addr, int op, uint32_t val)
+{
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+// Wait for *watch to move away from seen (p_tail for an empty ring, c_tail
+// for a full one): spin for the thread's budget, then register as a waiter
+// and sleep on futex_word. Returns after a spin or a wakeup, so callers
+// re-check the ring
+static void ring_wait(struct ring_waiter *w, uint32_t *futex_word, uint32_t *waiters,
+                      uint32_t *watch, uint32_t seen)
+{
+    if (w->spins < wait_spin_budget)
+    {
+        w->spins++;
+        ring_pause();
+        return;
+    }
+
+    // Registering before the final re-check pairs with the fence in
+    // ring_wake: either we see the new index, or the waker sees us and bumps
+    // the futex word so FUTEX_WAIT returns immediately
+    __atomic_fetch_add(waiters, 1, __ATOMIC_SEQ_CST);
+    uint32_t seq = __atomic_load_n(futex_word, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(watch, __ATOMIC_SEQ_CST) == seen)
+        futex(futex_word, FUTEX_WAIT, seq);
+    __atomic_fetch_sub(waiters, 1, __ATOMIC_RELAXED);
+
+    w->slept = true;
+    w->spins = 0;
+}
+
+// Adapt the spin budget once a wait is over
+static inline void ring_wait_done(struct ring_waiter *w)
+{
+    if (w->slept)
+    {
+        if (wait_spin_budget > RING_WAIT_SPIN_MIN)
+            wait_spin_budget /= 2;
+    }
+    else if (w->spins > 0 && wait_spin_budget < RING_WAIT_SPIN_MAX)
+        wait_spin_budget *= 2;
+}
+
+// Wake up to n threads sleeping on futex_word after publishing n slots
+// Costs a fence and a load when nobody is waiting
+static inline void ring_wake(uint32_t *futex_word, uint32_t *waiters, unsigned n)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_RELAXED) == 0)
+        return;
+    __atomic_fetch_add(futex_word, 1, __ATOMIC_SEQ_CST);
+    futex(futex_word, FUTEX_WAKE, n);
+}
+
+// Wait until the threads that reserved slots before us have published them,
+// then publish our own slots by moving the tail past them
+static inline void ring_publish(uint32_t *tail, uint32_t head, uint32_t next)
+{
+    unsigned spins = 0;
+    while (__atomic_load_n(tail, __ATOMIC_RELAXED) != head)
+        ring_backoff(&spins);
+    __atomic_store_n(tail, next, __ATOMIC_RELEASE);
+}
 
 // Initialize the ring buffer
 // Set p_tail, p_head, c_tail, and c_head to 0
 // Return 0 on success, negative value on failure
 int init_ring(struct ring *r)
 {
-    printf("init_ring: r = %p\n", (void *)r);
     if (r == NULL)
     {
         printf("init_ring: r is NULL\n");
@@ -18,50 +125,216 @@ int init_ring(struct ring *r)
     r->p_head = 0;
     r->c_tail = 0;
     r->c_head = 0;
-    pthread_mutex_init(&r->mutex, NULL); // Initialize the mutex
-    pthread_cond_init(&r->cond, NULL);   // Initialize the condition variable
-    printf("init_ring: Initialization successful\n");
+    r->c_futex = 0;
+    r->c_waiters = 0;
+    r->p_futex = 0;
+    r->p_waiters = 0;
+    r->num_shards = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
     return 0;
 }
 
+// Reserve up to n producer slots, blocking until at least one is free
+// Returns the number of slots reserved; *head is set to the first of them
+static unsigned ring_reserve_prod(struct ring *r, unsigned n, uint32_t *head)
+{
+    struct ring_waiter w = {0, false};
+    unsigned count;
+    uint32_t cur = __atomic_load_n(&r->p_head, __ATOMIC_RELAXED);
+    do
+    {
+        // The ring is full while the producer head is a whole ring ahead of
+        // the last slot the consumers have released
+        uint32_t tail, free_slots;
+        while ((free_slots = RING_SIZE - (cur - (tail = __atomic_load_n(&r->c_tail, __ATOMIC_ACQUIRE)))) == 0)
+        {
+            ring_wait(&w, &r->p_futex, &r->p_waiters, &r->c_tail, tail);
+            cur = __atomic_load_n(&r->p_head, __ATOMIC_RELAXED);
+        }
+        count = n < free_slots ? n : free_slots;
+    } while (!__atomic_compare_exchange_n(&r->p_head, &cur, cur + count, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    ring_wait_done(&w);
+    *head = cur;
+    return count;
+}
+
+// Reserve up to n consumer slots, blocking until at least one is published
+// Returns the number of slots reserved; *head is set to the first of them
+static unsigned ring_reserve_cons(struct ring *r, unsigned n, uint32_t *head)
+{
+    struct ring_waiter w = {0, false};
+    unsigned count;
+    uint32_t cur = __atomic_load_n(&r->c_head, __ATOMIC_RELAXED);
+    do
+    {
+        // Nothing to consume until producers have published past c_head
+        uint32_t avail;
+        while ((avail = __atomic_load_n(&r->p_tail, __ATOMIC_ACQUIRE) - cur) == 0)
+        {
+            ring_wait(&w, &r->c_futex, &r->c_waiters, &r->p_tail, cur);
+            cur = __atomic_load_n(&r->c_head, __ATOMIC_RELAXED);
+        }
+        count = n < avail ? n : avail;
+    } while (!__atomic_compare_exchange_n(&r->c_head, &cur, cur + count, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    ring_wait_done(&w);
+    *head = cur;
+    return count;
+}
+
 // Submit a new item to the ring buffer
 // Block if there's not enough space
-// Make sure it's thread-safe
+// Lock-free: the slot is reserved with a CAS on p_head and published in
+// reservation order through p_tail
 void ring_submit(struct ring *r, struct buffer_descriptor *bd)
 {
     if (r == NULL || bd == NULL)
     {
         return;
     }
-    pthread_mutex_lock(&r->mutex); // Lock the mutex to ensure exclusive access
-    while ((r->p_head + 1) % RING_SIZE == r->c_tail)
-    {
-        // Buffer is full, wait on the condition variable
-        pthread_cond_wait(&r->cond, &r->mutex);
-    }
-    r->buffer[r->p_head] = *bd;              // Add the item to the buffer
-    r->p_head = (r->p_head + 1) % RING_SIZE; // Update the producer head
-    pthread_cond_signal(&r->cond);           // Signal the condition variable to notify consumers
-    pthread_mutex_unlock(&r->mutex);         // Unlock the mutex
+    uint32_t head;
+    ring_reserve_prod(r, 1, &head);
+    r->buffer[head & RING_MASK] = *bd; // Copy the item into the reserved slot
+    ring_publish(&r->p_tail, head, head + 1);
+    ring_wake(&r->c_futex, &r->c_waiters, 1);
 }
 
 // Get an item from the ring buffer
 // Block if the buffer is empty
-// Make sure it's thread-safe
+// Lock-free: mirror image of ring_submit on c_head/c_tail
 void ring_get(struct ring *r, struct buffer_descriptor *bd)
 {
     if (r == NULL || bd == NULL)
     {
         return;
     }
-    pthread_mutex_lock(&r->mutex); // Lock the mutex to ensure exclusive access
-    while (r->c_head == r->p_tail)
+    uint32_t head;
+    ring_reserve_cons(r, 1, &head);
+    *bd = r->buffer[head & RING_MASK]; // Retrieve the item from the reserved slot
+    ring_publish(&r->c_tail, head, head + 1);
+    ring_wake(&r->p_futex, &r->p_waiters, 1);
+}
+
+// Submit up to n items with a single reservation and a single publish
+// Block until at least one slot is free, return how many were submitted
+unsigned ring_submit_burst(struct ring *r, struct buffer_descriptor *bds, unsigned n)
+{
+    if (r == NULL || bds == NULL || n == 0)
+    {
+        return 0;
+    }
+    uint32_t head;
+    unsigned count = ring_reserve_prod(r, n, &head);
+    for (unsigned i = 0; i < count; i++)
+        r->buffer[(head + i) & RING_MASK] = bds[i];
+    ring_publish(&r->p_tail, head, head + count);
+    ring_wake(&r->c_futex, &r->c_waiters, count);
+    return count;
+}
+
+// Get up to n items with a single reservation and a single release
+// Block until at least one item is available, return how many were fetched
+unsigned ring_get_burst(struct ring *r, struct buffer_descriptor *bds, unsigned n)
+{
+    if (r == NULL || bds == NULL || n == 0)
+    {
+        return 0;
+    }
+    uint32_t head;
+    unsigned count = ring_reserve_cons(r, n, &head);
+    for (unsigned i = 0; i < count; i++)
+        bds[i] = r->buffer[(head + i) & RING_MASK];
+    ring_publish(&r->c_tail, head, head + count);
+    ring_wake(&r->p_futex, &r->p_waiters, count);
+    return count;
+}
+
+// Single producer: p_head is private to the caller, so reserving is a plain
+// load and publishing needs no wait on other producers
+unsigned ring_submit_burst_sp(struct ring *r, struct buffer_descriptor *bds, unsigned n, struct ring *bell)
+{
+    if (r == NULL || bds == NULL || n == 0)
+    {
+        return 0;
+    }
+    struct ring_waiter w = {0, false};
+    uint32_t head = __atomic_load_n(&r->p_head, __ATOMIC_RELAXED);
+    uint32_t tail, free_slots;
+    while ((free_slots = RING_SIZE - (head - (tail = __atomic_load_n(&r->c_tail, __ATOMIC_ACQUIRE)))) == 0)
+        ring_wait(&w, &r->p_futex, &r->p_waiters, &r->c_tail, tail);
+    ring_wait_done(&w);
+
+    unsigned count = n < free_slots ? n : free_slots;
+    for (unsigned i = 0; i < count; i++)
+        r->buffer[(head + i) & RING_MASK] = bds[i];
+    __atomic_store_n(&r->p_head, head + count, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->p_tail, head + count, __ATOMIC_RELEASE);
+    ring_wake(&bell->c_futex, &bell->c_waiters, count);
+    return count;
+}
+
+unsigned ring_count(struct ring *r)
+{
+    uint32_t head = __atomic_load_n(&r->c_head, __ATOMIC_RELAXED);
+    return __atomic_load_n(&r->p_tail, __ATOMIC_RELAXED) - head;
+}
+
+unsigned ring_try_get_burst(struct ring *r, struct buffer_descriptor *bds, unsigned n)
+{
+    if (r == NULL || bds == NULL || n == 0)
     {
-        // Buffer is empty, wait on the condition variable
-        pthread_cond_wait(&r->cond, &r->mutex);
+        return 0;
     }
-    *bd = r->buffer[r->c_head];              // Retrieve an item from the buffer
-    r->c_head = (r->c_head + 1) % RING_SIZE; // Update the consumer head
-    pthread_cond_signal(&r->cond);           // Signal the condition variable to notify producers
-    pthread_mutex_unlock(&r->mutex);         // Unlock the mutex
-}
\ No newline at end of file
+    unsigned count;
+    uint32_t cur = __atomic_load_n(&r->c_head, __ATOMIC_RELAXED);
+    do
+    {
+        uint32_t avail = __atomic_load_n(&r->p_tail, __ATOMIC_ACQUIRE) - cur;
+        if (avail == 0)
+            return 0;
+        count = n < avail ? n : avail;
+    } while (!__atomic_compare_exchange_n(&r->c_head, &cur, cur + count, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    for (unsigned i = 0; i < count; i++)
+        bds[i] = r->buffer[(cur + i) & RING_MASK];
+    ring_publish(&r->c_tail, cur, cur + count);
+    ring_wake(&r->p_futex, &r->p_waiters, count);
+    return count;
+}
+
+// Register as a sleeper before the caller's last look at the rings, the
+// same handshake ring_wait does with a single ring
+uint32_t ring_bell_arm(struct ring *bell)
+{
+    __atomic_fetch_add(&bell->c_waiters, 1, __ATOMIC_SEQ_CST);
+    uint32_t token = __atomic_load_n(&bell->c_futex, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return token;
+}
+
+void ring_bell_wait(struct ring *bell, uint32_t token)
+{
+    futex(&bell->c_futex, FUTEX_WAIT, token);
+    __atomic_fetch_sub(&bell->c_waiters, 1, __ATOMIC_RELAXED);
+}
+
+void ring_bell_cancel(struct ring *bell)
+{
+    __atomic_fetch_sub(&bell->c_waiters, 1, __ATOMIC_RELAXED);
+}
+
+// The ready flag plays the role of the ring index: sleep while it is still 0
+void completion_wait(struct completion_bell *bell, int *ready)
+{
+    struct ring_waiter w = {0, false};
+    while (!__atomic_load_n(ready, __ATOMIC_ACQUIRE))
+        ring_wait(&w, &bell->futex, &bell->waiting, (uint32_t *)ready, 0);
+    ring_wait_done(&w);
+}
+
+void completion_notify(struct completion_bell *bell)
+{
+    ring_wake(&bell->futex, &bell->waiting, 1);
+}
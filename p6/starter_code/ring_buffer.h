@@ -4,11 +4,30 @@
 #include <stdbool.h>
 #include "common.h"
 
+/* Must be a power of two - indices are free-running and masked with RING_MASK */
 #define RING_SIZE 1024
+#define RING_MASK (RING_SIZE - 1)
 
 enum REQUEST_TYPE {
   PUT = 0,
-  GET
+  GET,
+  MPUT,	/* Several PUTs at once - keys and values are in a multi_payload */
+  MGET,	/* Several GETs at once - the server fills in the payload's values */
+  DEL,	/* Remove k - a later GET returns 0 */
+  VPUT,	/* PUT of a variable-length key and value - they are in a blob_payload (see blob.h) */
+  VGET	/* GET of a variable-length key - the server answers with an arena entry */
+};
+
+/* Keys per MGET/MPUT request */
+#define MAX_MULTI_KEYS 64
+
+/* Keys and values of an MGET/MPUT, one per window of the Request-status
+ * Board. The client fills it in before submitting and, for an MGET, reads
+ * the values back once the window is ready */
+struct multi_payload {
+	uint32_t n;
+	key_type keys[MAX_MULTI_KEYS];
+	value_type values[MAX_MULTI_KEYS];
 };
 
 /* Client sends requests using this format - Each element of the ring is 
@@ -31,10 +50,46 @@ struct buffer_descriptor {
 	 * The client program will reset the flag to 0 before using the same 
 	 * location for completion */
   	int ready;
+	/* Byte offset of the submitting thread's completion_bell, or 0 if the
+	 * client busy-polls and does not need to be woken up */
+	int notify_off;
+	union {
+		/* MGET/MPUT only: byte offset of the request's multi_payload
+		 * VPUT/VGET only: byte offset of its blob_payload, and k is the key's hash */
+		int payload_off;
+		/* PUT only: lifetime of the key in ms if the server runs as a cache,
+		 * 0 for the server's default */
+		uint32_t ttl_ms;
+	};
+	/* Byte offset of the submitting thread's completion ring if it reaps
+	 * completions out of order, 0 to complete through the board at res_off */
+	int cq_off;
+	/* Opaque to the server - echoed back in the completion record */
+	uint32_t tag;
+	/* Latency tracing (client -L): CLOCK_MONOTONIC ns when the client
+	 * submitted the request, a server thread dequeued it and completed it.
+	 * The server only stamps requests whose t_submit is set. These fields
+	 * bring the descriptor to exactly one cache line */
+	uint64_t t_submit;
+	uint64_t t_dequeue;
+	uint64_t t_complete;
+};
+
+/* One per client thread when completions are event-driven: a client thread
+ * that finds its next window not ready spins for a while, then registers in
+ * waiting and sleeps on futex. After posting a completion the server only
+ * bumps futex and issues a wake while waiting is set */
+struct __attribute__((aligned(64))) completion_bell {
+	uint32_t futex;
+	uint32_t waiting;
 };
 
 /* This structure is laid out at the beginning of the shared memory region
- * You can add new fields to the structure (It's very unlikely that you need to) */
+ * You can add new fields to the structure (It's very unlikely that you need to)
+ * All four indices are free-running 32-bit counters (they wrap naturally) and
+ * are only ever accessed with atomic builtins. Producers reserve slots by CAS on
+ * p_head and publish them in order by advancing p_tail; consumers do the same
+ * with c_head and c_tail. */
 struct __attribute__((packed, aligned(64))) ring {
 	/* Producer tail - where the last valid item is */
 	uint32_t p_tail; 
@@ -51,6 +106,31 @@ struct __attribute__((packed, aligned(64))) ring {
 	/* Consumer head - next consumer will consume the data pointed by c_head */
 	uint32_t c_head;
 	char pad4[60];
+	/* Consumers that found the ring empty sleep on c_futex (a non-private
+	 * futex, since the ring is shared between processes) after spinning.
+	 * Producers only bump it and issue a wake while c_waiters is non-zero */
+	uint32_t c_futex;
+	uint32_t c_waiters;
+	char pad5[56];
+	/* Same for producers that found the ring full */
+	uint32_t p_futex;
+	uint32_t p_waiters;
+	char pad6[56];
+	/* Only meaningful in the ring at the start of the shared region: number
+	 * of per-client-thread submission rings laid out right after it (0 when
+	 * every client thread submits to this ring) */
+	uint32_t num_shards;
+	/* Likewise: number of per-partition rings laid out right after it in
+	 * partitioned mode, where server thread i alone serves partition i */
+	uint32_t num_partitions;
+	/* Likewise: byte offset of the server's struct kv_stats, 0 if there is
+	 * none (see kv_stats.h) */
+	uint32_t stats_off;
+	/* Likewise: where the server keeps VPUT values, 0 if there is no arena
+	 * (see blob.h) */
+	uint32_t arena_off;
+	uint32_t arena_size;
+	char pad7[44];
 	/* An array of structs - This is the actual ring */
 	struct buffer_descriptor buffer[RING_SIZE];
 };
@@ -81,3 +161,71 @@ void ring_submit(struct ring *r, struct buffer_descriptor *bd);
  * the signature.
 */
 void ring_get(struct ring *r, struct buffer_descriptor *bd); 
+
+/*
+ * Submit up to n items in one operation - thread-safe
+ * Slots for the whole batch are reserved with one CAS and published with one
+ * tail update. Blocks until at least one slot is free.
+ * @param r The shared ring
+ * @param bds Array of n valid buffer_descriptors
+ * @param n Number of items in bds
+ * @return Number of items submitted (1..n), 0 if n is 0
+*/
+unsigned ring_submit_burst(struct ring *r, struct buffer_descriptor *bds, unsigned n);
+
+/*
+ * Get up to n items in one operation - thread-safe
+ * Blocks until at least one item is available, then takes as many as are
+ * published, up to n.
+ * @param r The shared ring
+ * @param bds Array with room for n buffer_descriptors
+ * @param n Maximum number of items to fetch
+ * @return Number of items fetched (1..n), 0 if n is 0
+*/
+unsigned ring_get_burst(struct ring *r, struct buffer_descriptor *bds, unsigned n);
+
+/*
+ * Sharded mode: every client thread owns one submission ring, server threads
+ * poll several of them and sleep on a shared doorbell ring when all are empty
+ */
+
+/*
+ * Submit up to n items to a ring that only the calling thread produces into
+ * Same blocking behaviour as ring_submit_burst, but without the CAS and the
+ * in-order publish, and wakes a server sleeping on bell
+ * @return Number of items submitted (1..n), 0 if n is 0
+*/
+unsigned ring_submit_burst_sp(struct ring *r, struct buffer_descriptor *bds, unsigned n, struct ring *bell);
+
+/*
+ * Number of items submitted but not yet taken by a consumer - a snapshot
+ * that may be stale by the time it returns
+*/
+unsigned ring_count(struct ring *r);
+
+/*
+ * Get up to n items without blocking - thread-safe
+ * @return Number of items fetched, 0 if the ring is empty
+*/
+unsigned ring_try_get_burst(struct ring *r, struct buffer_descriptor *bds, unsigned n);
+
+/*
+ * Sleeping on the doorbell: arm, check every ring once more, then either
+ * wait (if they were all empty) or cancel
+ * @return A token to pass to ring_bell_wait
+*/
+uint32_t ring_bell_arm(struct ring *bell);
+void ring_bell_wait(struct ring *bell, uint32_t token);
+void ring_bell_cancel(struct ring *bell);
+
+/*
+ * Wait until *ready becomes non-zero - client side of a completion_bell
+ * Spins for an adaptive budget before sleeping on the bell
+*/
+void completion_wait(struct completion_bell *bell, int *ready);
+
+/*
+ * Wake the client thread behind bell if it went to sleep - call after the
+ * ready flag of one of its windows has been set
+*/
+void completion_notify(struct completion_bell *bell);
@@ -24,5 +24,62 @@ int main()
     printf("Item 1: req_type=%d, k=%u, v=%u\n", bd_out1.req_type, bd_out1.k, bd_out1.v);
     printf("Item 2: req_type=%d, k=%u\n", bd_out2.req_type, bd_out2.k);
 
+    // Bursts: push the indices across the end of the ring so the copies wrap
+    struct buffer_descriptor in[100], out[100];
+    for (int round = 0; round < 30; round++)
+    {
+        for (int i = 0; i < 100; i++)
+            in[i] = (struct buffer_descriptor){PUT, round * 100 + i, i, 0, 0};
+
+        unsigned sent = ring_submit_burst(&r, in, 100);
+        unsigned got = ring_get_burst(&r, out, 100);
+        if (sent != 100 || got != 100)
+        {
+            printf("Burst round %d moved %u/%u items\n", round, sent, got);
+            return 1;
+        }
+        for (int i = 0; i < 100; i++)
+        {
+            if (out[i].k != in[i].k || out[i].v != in[i].v)
+            {
+                printf("Burst round %d item %d: got k=%u, expected k=%u\n", round, i, out[i].k, in[i].k);
+                return 1;
+            }
+        }
+    }
+
+    // A burst never takes more than is available
+    ring_submit(&r, &bd1);
+    if (ring_get_burst(&r, out, 100) != 1)
+    {
+        printf("Burst get returned more items than were submitted\n");
+        return 1;
+    }
+    printf("Burst tests passed\n");
+
+    // Single-producer ring with a separate doorbell
+    struct ring sq, bell;
+    init_ring(&sq);
+    init_ring(&bell);
+    if (ring_try_get_burst(&sq, out, 100) != 0)
+    {
+        printf("Empty ring returned items\n");
+        return 1;
+    }
+    for (int round = 0; round < 30; round++)
+    {
+        for (int i = 0; i < 100; i++)
+            in[i] = (struct buffer_descriptor){GET, round * 100 + i, 0, 0, 0};
+        if (ring_submit_burst_sp(&sq, in, 100, &bell) != 100 ||
+            ring_try_get_burst(&sq, out, 60) != 60 ||
+            ring_try_get_burst(&sq, out + 60, 60) != 40 ||
+            out[99].k != in[99].k)
+        {
+            printf("Single-producer round %d failed\n", round);
+            return 1;
+        }
+    }
+    printf("Single-producer tests passed\n");
+
     return 0;
 }
\ No newline at end of file
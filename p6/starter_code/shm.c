@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+#include "shm.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SMALL_PAGE_SIZE 4096
+
+// Map fd and fault every page in writable so the hot path never does
+// MAP_POPULATE alone only read-faults a shared mapping, so writes still
+// trap once per page unless MADV_POPULATE_WRITE (Linux 5.14) is available
+static char *map_populated(int fd, size_t size, int flags)
+{
+    char *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    // Advisory: tmpfs and memfd only honour it if shmem THP is enabled
+    if (flags & SHM_HUGE)
+        madvise(mem, size, MADV_HUGEPAGE);
+
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(mem, size, MADV_POPULATE_WRITE) == 0)
+        return mem;
+#endif
+    // Contents may already be live (attach), so touch without changing them
+    for (size_t off = 0; off < size; off += SMALL_PAGE_SIZE)
+        __atomic_fetch_add(&mem[off], 0, __ATOMIC_RELAXED);
+    return mem;
+}
+
+// hugetlb memfds fail at mmap time when no huge pages are reserved, so
+// try that first and fall back to a regular memfd with THP
+static int create_memfd(struct shm_region *r, int flags)
+{
+    if (flags & SHM_HUGE)
+    {
+        int fd = memfd_create("kv_shm", MFD_HUGETLB);
+        if (fd >= 0)
+        {
+            if (ftruncate(fd, r->size) == 0 && (r->mem = map_populated(fd, r->size, 0)) != NULL)
+            {
+                r->fd = fd;
+                return 0;
+            }
+            close(fd);
+        }
+    }
+
+    int fd = memfd_create("kv_shm", 0);
+    if (fd < 0)
+    {
+        perror("memfd_create");
+        return -1;
+    }
+    if (ftruncate(fd, r->size) == -1 || (r->mem = map_populated(fd, r->size, flags)) == NULL)
+    {
+        perror("memfd mmap");
+        close(fd);
+        return -1;
+    }
+    r->fd = fd;
+    return 0;
+}
+
+int shm_create(struct shm_region *r, const char *path, size_t size, int flags)
+{
+    r->size = size;
+    if (flags & SHM_HUGE)
+        r->size = (size + SHM_HUGE_PAGE_SIZE - 1) & ~(SHM_HUGE_PAGE_SIZE - 1);
+    r->fd = -1;
+
+    if (flags & SHM_MEMFD)
+        return create_memfd(r, flags);
+
+    int fd = open(path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    if (fd < 0)
+    {
+        perror("open");
+        return -1;
+    }
+    // Truncating to 0 first drops whatever a previous run left in the file,
+    // so the region starts zeroed without a memset pass over it
+    if (ftruncate(fd, 0) == -1 || ftruncate(fd, r->size) == -1)
+    {
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+    r->mem = map_populated(fd, r->size, flags);
+    // mmap dups the fd, no longer needed
+    close(fd);
+    if (r->mem == NULL)
+    {
+        perror("mmap");
+        return -1;
+    }
+    return 0;
+}
+
+int shm_attach(struct shm_region *r, const char *path, int fd, int flags)
+{
+    int own_fd = fd < 0;
+    if (own_fd && (fd = open(path, O_RDWR)) < 0)
+    {
+        perror("open");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        perror("fstat");
+        if (own_fd)
+            close(fd);
+        return -1;
+    }
+
+    r->size = st.st_size;
+    r->mem = map_populated(fd, r->size, flags);
+    if (own_fd)
+        close(fd);
+    r->fd = own_fd ? -1 : fd;
+    if (r->mem == NULL)
+    {
+        perror("mmap");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stddef.h>
+
+/* Back the region with a memfd instead of a file in the current directory */
+#define SHM_MEMFD 0x1
+/* Ask for 2 MiB pages: hugetlb for a memfd if the system has them reserved,
+ * transparent huge pages otherwise */
+#define SHM_HUGE 0x2
+
+#define SHM_HUGE_PAGE_SIZE (2UL << 20)
+
+/* The region shared by the client and the server */
+struct shm_region
+{
+	char *mem;
+	size_t size;
+	int fd; /* still open for a memfd so a forked server can inherit it, -1 otherwise */
+};
+
+/*
+ * Create and map a zeroed region of at least size bytes, pre-faulting
+ * every page so neither startup nor the first requests take page faults
+ * @param path File to create unless SHM_MEMFD is set
+ * @param flags SHM_MEMFD and/or SHM_HUGE
+ * @return 0 on success, -1 on failure
+ */
+int shm_create(struct shm_region *r, const char *path, size_t size, int flags);
+
+/*
+ * Map a region created by shm_create in another process
+ * @param path File to open if fd is negative
+ * @param fd Inherited memfd, or -1
+ * @param flags SHM_HUGE to request transparent huge pages
+ * @return 0 on success, -1 on failure
+ */
+int shm_attach(struct shm_region *r, const char *path, int fd, int flags);
@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "workload.h"
+
+// Convert a text workload to the binary format the client maps in place
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s workload.txt workload.bin\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct workload w;
+    if (workload_open(argv[1], &w) < 0)
+        return EXIT_FAILURE;
+    if (w.map != NULL)
+    {
+        fprintf(stderr, "%s is already a binary workload\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    if (workload_write(argv[2], &w) < 0)
+        return EXIT_FAILURE;
+    printf("%lu requests, %lu mget/mput keys, %lu bytes of vput/vget keys\n", w.num_requests, w.num_keys, w.num_bytes);
+    return EXIT_SUCCESS;
+}
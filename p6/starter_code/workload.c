@@ -0,0 +1,303 @@
+#include "workload.h"
+#include "ring_buffer.h"
+#include "blob.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WORKLOAD_LINE_LEN 2048
+
+// Grow an array of elem_size elements to hold at least need of them
+static int reserve(void **arr, uint64_t *cap, uint64_t need, size_t elem_size)
+{
+    if (need <= *cap)
+        return 0;
+    uint64_t new_cap = *cap ? *cap * 2 : 1024;
+    while (new_cap < need)
+        new_cap *= 2;
+    void *p = realloc(*arr, new_cap * elem_size);
+    if (p == NULL)
+        return -1;
+    *arr = p;
+    *cap = new_cap;
+    return 0;
+}
+
+// Parse a full 32-bit unsigned number, unlike atoi
+static int parse_u32(const char *tok, uint32_t *out)
+{
+    if (tok == NULL)
+        return -1;
+    char *end;
+    unsigned long x = strtoul(tok, &end, 10);
+    if (end == tok || x > UINT32_MAX)
+        return -1;
+    *out = x;
+    return 0;
+}
+
+// Whether the mapped header's arrays fit in size bytes, without overflowing
+static bool binary_fits(const struct workload_header *h, uint64_t size)
+{
+    if (size < sizeof(*h))
+        return false;
+    uint64_t left = size - sizeof(*h);
+    if (h->num_requests > left / sizeof(struct request))
+        return false;
+    left -= h->num_requests * sizeof(struct request);
+    if (h->num_keys > left / (sizeof(key_type) + sizeof(value_type)))
+        return false;
+    left -= h->num_keys * (sizeof(key_type) + sizeof(value_type));
+    return h->num_bytes <= left && h->num_bytes <= UINT32_MAX;
+}
+
+uint64_t workload_check(const struct workload *w, const struct request *reqs, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        const struct request *r = &reqs[i];
+        switch (r->t)
+        {
+        case PUT:
+        case GET:
+        case DEL:
+            break;
+
+        case MPUT:
+        case MGET:
+            if (r->k == 0 || r->k > MAX_MULTI_KEYS || r->v > w->num_keys || r->k > w->num_keys - r->v)
+                return i;
+            break;
+
+        case VPUT:
+        case VGET:
+        {
+            if (r->k >= w->num_bytes)
+                return i;
+            uint64_t key_len = strlen(w->bytes + r->k);
+            uint64_t val_len = r->t == VPUT ? r->v : 0;
+            if (key_len == 0 || key_len > BLOB_MAX_KEY || val_len > BLOB_MAX_VALUE ||
+                key_len + val_len > w->max_blob)
+                return i;
+            break;
+        }
+
+        default:
+            return i;
+        }
+    }
+    return n;
+}
+
+static int map_binary(int fd, struct workload *w)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        perror("fstat");
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    struct workload_header *h = map;
+    if ((size_t)st.st_size < sizeof(*h) || h->version != WORKLOAD_VERSION || !binary_fits(h, st.st_size) ||
+        h->max_blob > BLOB_MAX_KEY + BLOB_MAX_VALUE)
+    {
+        fprintf(stderr, "Truncated or unsupported binary workload\n");
+        munmap(map, st.st_size);
+        return -1;
+    }
+    // Threads walk their slices front to back
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    w->map = map;
+    w->map_size = st.st_size;
+    w->num_requests = h->num_requests;
+    w->reqs = (struct request *)(h + 1);
+    w->num_keys = h->num_keys;
+    w->keys = (key_type *)(w->reqs + w->num_requests);
+    w->values = (value_type *)(w->keys + w->num_keys);
+    w->num_bytes = h->num_bytes;
+    w->bytes = (char *)(w->values + w->num_keys);
+    w->max_blob = h->max_blob;
+
+    // Every key in the byte area then ends before the area does. The
+    // requests are checked by each client thread, on its own slice
+    if (w->num_bytes > 0 && w->bytes[w->num_bytes - 1] != '\0')
+    {
+        fprintf(stderr, "Truncated or unsupported binary workload\n");
+        munmap(map, st.st_size);
+        memset(w, 0, sizeof(*w));
+        return -1;
+    }
+    return 0;
+}
+
+// Parse the key (and length) of a vput/vget into r, appending the key to w
+static int parse_blob(char **save, struct request *r, struct workload *w, uint64_t *bytes_cap)
+{
+    char *key = strtok_r(NULL, " \n", save);
+    size_t key_len = key != NULL ? strlen(key) : 0;
+    if (key_len == 0 || key_len > BLOB_MAX_KEY || w->num_bytes + key_len + 1 > UINT32_MAX)
+        return -1;
+    r->v = 0;
+    if (r->t == VPUT && (parse_u32(strtok_r(NULL, " \n", save), &r->v) < 0 || r->v > BLOB_MAX_VALUE))
+        return -1;
+    if (reserve((void **)&w->bytes, bytes_cap, w->num_bytes + key_len + 1, 1) < 0)
+        return -1;
+
+    r->k = w->num_bytes;
+    memcpy(w->bytes + w->num_bytes, key, key_len + 1);
+    w->num_bytes += key_len + 1;
+    if (key_len + r->v > w->max_blob)
+        w->max_blob = key_len + r->v;
+    return 0;
+}
+
+// Parse one line into r, appending the keys of an mget/mput/vput/vget to w
+static int parse_line(char *line, struct request *r, struct workload *w, uint64_t *caps)
+{
+    char *save;
+    char *tok = strtok_r(line, " \n", &save);
+    if (tok == NULL)
+        return -1;
+
+    if (!strcmp(tok, "vput") || !strcmp(tok, "vget"))
+    {
+        r->t = tok[1] == 'p' ? VPUT : VGET;
+        return parse_blob(&save, r, w, &caps[2]);
+    }
+
+    if (!strcmp(tok, "put") || !strcmp(tok, "get") || !strcmp(tok, "del"))
+    {
+        r->t = tok[0] == 'p' ? PUT : tok[0] == 'g' ? GET : DEL;
+        r->v = 0;
+        if (parse_u32(strtok_r(NULL, " \n", &save), &r->k) < 0)
+            return -1;
+        if (r->t == PUT && parse_u32(strtok_r(NULL, " \n", &save), &r->v) < 0)
+            return -1;
+        return 0;
+    }
+    if (strcmp(tok, "mput") && strcmp(tok, "mget"))
+        return -1;
+
+    r->t = tok[1] == 'p' ? MPUT : MGET;
+    r->k = 0;
+    r->v = w->num_keys;
+    if (reserve((void **)&w->keys, &caps[0], w->num_keys + MAX_MULTI_KEYS, sizeof(key_type)) < 0 ||
+        reserve((void **)&w->values, &caps[1], w->num_keys + MAX_MULTI_KEYS, sizeof(value_type)) < 0)
+        return -1;
+
+    while ((tok = strtok_r(NULL, " \n", &save)) != NULL)
+    {
+        if (r->k == MAX_MULTI_KEYS)
+            return -1;
+        uint64_t i = r->v + r->k;
+        if (parse_u32(tok, &w->keys[i]) < 0)
+            return -1;
+        w->values[i] = 0;
+        if (r->t == MPUT && parse_u32(strtok_r(NULL, " \n", &save), &w->values[i]) < 0)
+            return -1;
+        r->k++;
+    }
+    if (r->k == 0)
+        return -1;
+    w->num_keys += r->k;
+    return 0;
+}
+
+static int parse_text(FILE *f, struct workload *w)
+{
+    uint64_t reqs_cap = 0;
+    uint64_t caps[3] = {0}; // Of keys, values and bytes
+    char line[WORKLOAD_LINE_LEN];
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (reserve((void **)&w->reqs, &reqs_cap, w->num_requests + 1, sizeof(struct request)) < 0)
+        {
+            perror("realloc");
+            return -1;
+        }
+        if (parse_line(line, &w->reqs[w->num_requests], w, caps) == 0)
+            w->num_requests++;
+    }
+    return 0;
+}
+
+int workload_open(const char *path, struct workload *w)
+{
+    memset(w, 0, sizeof(*w));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("open");
+        return -1;
+    }
+
+    uint32_t magic = 0;
+    int rc;
+    if (read(fd, &magic, sizeof(magic)) == sizeof(magic) && magic == WORKLOAD_MAGIC)
+        rc = map_binary(fd, w);
+    else
+    {
+        FILE *f = fdopen(fd, "r");
+        if (f == NULL)
+        {
+            close(fd);
+            return -1;
+        }
+        rewind(f);
+        rc = parse_text(f, w);
+        fclose(f);
+        return rc;
+    }
+    close(fd);
+    return rc;
+}
+
+int workload_write(const char *path, const struct workload *w)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return -1;
+    }
+    struct workload_header h = {
+        .magic = WORKLOAD_MAGIC,
+        .version = WORKLOAD_VERSION,
+        .num_requests = w->num_requests,
+        .num_keys = w->num_keys,
+        .num_bytes = w->num_bytes,
+        .max_blob = w->max_blob,
+    };
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(w->reqs, sizeof(struct request), w->num_requests, f) == w->num_requests &&
+             fwrite(w->keys, sizeof(key_type), w->num_keys, f) == w->num_keys &&
+             fwrite(w->values, sizeof(value_type), w->num_keys, f) == w->num_keys &&
+             fwrite(w->bytes, 1, w->num_bytes, f) == w->num_bytes;
+    if (fclose(f) != 0 || !ok)
+    {
+        perror("fwrite");
+        return -1;
+    }
+    return 0;
+}
+
+void workload_willneed(const struct request *reqs, uint64_t n)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)reqs & ~(uintptr_t)(page - 1);
+    uintptr_t end = (uintptr_t)(reqs + n);
+    if (n > 0)
+        madvise((void *)start, end - start, MADV_WILLNEED);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+/* One request of a workload, and the record format of binary workloads
+ * MGET/MPUT keep their keys in the workload's key area: k is the number
+ * of keys and v the index of the first one
+ * VPUT/VGET keep their key, NUL-terminated, in the byte area: k is its
+ * offset there and v the length of a VPUT's value, whose bytes are
+ * generated from the request's index (see blob_fill) */
+struct request {
+	uint32_t t;	  /* enum REQUEST_TYPE */
+	key_type k;
+	value_type v; /* PUT and VPUT only */
+};
+
+#define WORKLOAD_MAGIC 0x4c57564b /* "KVWL" in a little-endian file */
+#define WORKLOAD_VERSION 2
+
+/* A binary workload file is laid out as follows, in host byte order:
+ * | HEADER | REQUEST_0 | ... | REQUEST_N | KEY_0 | ... | KEY_M | VALUE_0 | ... | VALUE_M | BYTES |
+ * so it can be mapped and used in place */
+struct workload_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t num_requests;
+	uint64_t num_keys;
+	uint64_t num_bytes;
+	uint64_t max_blob; /* Largest key length plus value length of a VPUT/VGET */
+};
+
+struct workload {
+	uint64_t num_requests;
+	struct request *reqs;
+	uint64_t num_keys;	 /* Keys of every MGET/MPUT, back to back */
+	key_type *keys;
+	value_type *values;	 /* MPUT values, 0 for MGET keys */
+	uint64_t num_bytes;	 /* Keys of every VPUT/VGET, back to back - under 4 GiB */
+	char *bytes;
+	uint64_t max_blob;
+	void *map;			 /* Mapping of a binary file, NULL if parsed from text */
+	size_t map_size;
+};
+
+/*
+ * Load a workload: a binary file is mapped read-only and used in place, a
+ * text file ("put k v", "get k", "del k", "mget k1 k2 ...", "mput k1 v1 k2 v2 ...",
+ * "vput key length", "vget key", one request per line, where key is any
+ * string without blanks) is parsed in one pass - invalid lines are skipped
+ * @return 0 on success, -1 on failure
+ */
+int workload_open(const char *path, struct workload *w);
+
+/*
+ * Write w as a binary workload file
+ * @return 0 on success, -1 on failure
+ */
+int workload_write(const char *path, const struct workload *w);
+
+/*
+ * Check n requests of w, a slice of w->reqs, against what the text parser
+ * accepts, so a bad binary file can't send the client past the ends of its
+ * arrays - workload_open only checks that the arrays fit in the file
+ * @return the index in reqs of the first bad request, n if all are valid
+ */
+uint64_t workload_check(const struct workload *w, const struct request *reqs, uint64_t n);
+
+/*
+ * Ask the kernel to start reading n requests from reqs in the background -
+ * each client thread calls this for its own slice of a mapped workload
+ */
+void workload_willneed(const struct request *reqs, uint64_t n);